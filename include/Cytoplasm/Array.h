@@ -118,9 +118,29 @@ extern void *ArraySet(Array *, size_t, void *);
  */
 extern bool ArrayAdd(Array *, void *);
 
+/**
+ * Append the given number of elements from the given C array to the
+ * end of the specified array, all at once. None of the elements may
+ * be NULL. This function returns a boolean value indicating whether
+ * or not it succeeded; if it didn't, the array is left unchanged.
+ */
+extern bool ArrayAddAll(Array *, void **, size_t);
+
+/**
+ * Make sure that the specified array has room for at least the given
+ * number of elements in total, so that adding elements up to that
+ * number doesn't have to allocate memory. Arrays grow by doubling on
+ * their own, so this is never required, but it saves the copies along
+ * the way when the final size is known up front. This function
+ * returns a boolean value indicating whether or not it succeeded.
+ */
+extern bool ArrayReserve(Array *, size_t);
+
 /**
  * Remove the element at the specified index from the specified array.
- * This function returns the element removed, if any.
+ * This function returns the element removed, if any. When most of the
+ * elements of an array have been removed, some of its memory is given
+ * back.
  */
 extern void *ArrayDelete(Array *, size_t);
 
@@ -134,9 +154,36 @@ extern void *ArrayDelete(Array *, size_t);
  * ``bigger'' than the second item and should thus appear after it in
  * the array. A return value less than 0 indicates the opposite: the
  * second element should appear after the first in the array.
+ * .Pp
+ * This sort is not stable: elements that compare equal may not keep
+ * their order. It takes O(n log n) time at worst, and close to linear
+ * time on arrays that are already sorted or reversed.
  */
 extern void ArraySort(Array *, int (*) (void *, void *));
 
+/**
+ * Sort the specified array like
+ * .Fn ArraySort
+ * does, but keep elements that compare equal in the order they were
+ * in. This needs memory for half of the elements while it sorts. It
+ * returns a boolean value indicating whether or not it succeeded; if
+ * the memory couldn't be allocated, the array is left unchanged.
+ */
+extern bool ArraySortStable(Array *, int (*) (void *, void *));
+
+/**
+ * Sort the specified array like
+ * .Fn ArraySortStable
+ * does, but split the work between the given number of threads, or
+ * one thread per online CPU if it is 0. This only pays off for very
+ * large arrays, so smaller ones are sorted on the calling thread. The
+ * comparison function is called from several threads at once, so it
+ * must be safe to do so. This function needs memory for all of the
+ * elements while it sorts, and returns a boolean value indicating
+ * whether or not it succeeded.
+ */
+extern bool ArraySortParallel(Array *, int (*) (void *, void *), size_t);
+
 /**
  * Remove all duplicates from an array by using the given comparison
  * function to sort the array, then remove matching values. This
@@ -145,10 +192,9 @@ extern void ArraySort(Array *, int (*) (void *, void *));
  * to values, usually values on the heap. Thus, it is possible to lose
  * pointers to duplicate values and have them leak.
  * .P
- * This is a relatively expensive operation. The array must first be
- * duplicated. Then it is sorted, then it is iterated from beginning
- * to end to remove duplicate entries. Note that the comparison
- * function is executed on each element at least twice.
+ * The array is duplicated, sorted stably, and then compacted in one
+ * pass, so this takes O(n log n) time, and the first of each set of
+ * duplicates is the one that is kept.
  */
 extern Array *ArrayUnique(Array *, int (*) (void *, void *));
 
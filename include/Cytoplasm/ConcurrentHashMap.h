@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef CYTOPLASM_CONCURRENTHASHMAP_H
+#define CYTOPLASM_CONCURRENTHASHMAP_H
+
+/***
+ * @Nm ConcurrentHashMap
+ * @Nd A hash map that can be shared between threads.
+ * @Dd October 16 2026
+ * @Xr HashMap
+ *
+ * .Nm
+ * is a hash map that any number of threads can read from and write
+ * to at the same time, without wrapping it in a lock of their own. It
+ * is meant for state that is shared by a whole program, such as
+ * routing tables and in-process caches, which are read far more often
+ * than they are written.
+ * .Pp
+ * The keys are split over a fixed number of stripes, each of which is
+ * an ordinary
+ * .Xr HashMap 3
+ * guarded by its own read-write lock. Lookups only take a read lock,
+ * so they never wait for each other, and writes only wait for the
+ * threads that are using the same stripe.
+ * .Pp
+ * Like
+ * .Xr HashMap 3 ,
+ * the map copies its keys, but only stores pointers to its values. A
+ * value returned by this API may be removed from the map by another
+ * thread right after it is returned, so the values should either
+ * outlive the map, or be reference counted or otherwise protected by
+ * the caller.
+ */
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * These functions operate on an opaque structure, which the caller
+ * has no knowledge about.
+ */
+typedef struct ConcurrentHashMap ConcurrentHashMap;
+
+/**
+ * Create a new, empty concurrent hash map, or return NULL if there
+ * isn't enough memory for it.
+ */
+extern ConcurrentHashMap * ConcurrentHashMapCreate(void);
+
+/**
+ * Free the given map, along with the keys in it, but not the values.
+ * No other thread may be using the map at this point.
+ */
+extern void ConcurrentHashMapFree(ConcurrentHashMap *);
+
+/**
+ * Set the given key to the given value, and return the value that was
+ * there before, or NULL if there was none. This works just like
+ * .Fn HashMapSet .
+ */
+extern void * ConcurrentHashMapSet(ConcurrentHashMap *, char *, void *);
+
+/**
+ * Set the given key to the given value, unless the key is already in
+ * the map. This returns the value that is already in the map, in
+ * which case the map is left alone, or NULL if the given value was
+ * stored. Unlike a
+ * .Fn ConcurrentHashMapGet
+ * followed by a
+ * .Fn ConcurrentHashMapSet ,
+ * this happens all at once, so when multiple threads race to fill in
+ * the same key, exactly one of them wins, and the others are told
+ * which value won.
+ */
+extern void * ConcurrentHashMapInsert(ConcurrentHashMap *, char *, void *);
+
+/**
+ * Retrieve the value for the given key, or return NULL if no such
+ * key exists in the map.
+ */
+extern void * ConcurrentHashMapGet(ConcurrentHashMap *, const char *);
+
+/**
+ * Remove the given key from the map, and return its value to the
+ * caller to deal with, or NULL if no such key exists.
+ */
+extern void * ConcurrentHashMapDelete(ConcurrentHashMap *, const char *);
+
+/**
+ * Call the given function on every key and value in the map, along
+ * with the given pointer, until it returns false. Any number of
+ * threads may iterate over a map at the same time, and other threads
+ * may keep reading from it; writes to the part of the map that is
+ * being visited wait until the iteration moves past it. Keys that are
+ * set or deleted by other threads during the iteration may or may not
+ * be visited.
+ * .Pp
+ * The function must not write to the map itself. It should be
+ * reasonably quick, because it holds up writers while it runs.
+ */
+extern void
+ConcurrentHashMapIterate(ConcurrentHashMap *, bool (*) (char *, void *, void *), void *);
+
+#endif                             /* CYTOPLASM_CONCURRENTHASHMAP_H */
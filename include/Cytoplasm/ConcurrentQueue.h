@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef CYTOPLASM_CONCURRENTQUEUE_H
+#define CYTOPLASM_CONCURRENTQUEUE_H
+
+/***
+ * @Nm ConcurrentQueue
+ * @Nd A bounded queue that can be shared between threads.
+ * @Dd October 16 2026
+ * @Xr Queue ConcurrentHashMap
+ *
+ * .Nm
+ * is a fixed-size queue of pointers, like
+ * .Xr Queue 3 ,
+ * that any number of threads can push onto and pop from at the same
+ * time without a lock of their own. Pushing and popping never take a
+ * lock either: each slot of the queue carries a sequence number that
+ * says whose turn it is to use it, and threads claim slots by
+ * advancing the front or the back of the queue atomically.
+ * .Pp
+ * Threads that have nothing to do until something is pushed can
+ * block in
+ * .Fn ConcurrentQueueWait
+ * instead of polling. Only they ever take the lock of the queue;
+ * pushes only touch it when there is a thread waiting to be woken up.
+ */
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * These functions operate on a queue structure that is opaque to the
+ * caller.
+ */
+typedef struct ConcurrentQueue ConcurrentQueue;
+
+/**
+ * Allocate a new queue that is able to store at least the specified
+ * number of items in it. The size is rounded up to a power of two.
+ */
+extern ConcurrentQueue * ConcurrentQueueCreate(size_t);
+
+/**
+ * Free the memory associated with the specified queue. No threads may
+ * be using the queue anymore. Like
+ * .Fn QueueFree ,
+ * this does not free the items still in the queue.
+ */
+extern void ConcurrentQueueFree(ConcurrentQueue *);
+
+/**
+ * Push an element onto the back of the queue. This function returns
+ * a boolean value indicating whether or not the push succeeded; it
+ * fails if the queue is full, or the element is NULL.
+ */
+extern bool ConcurrentQueuePush(ConcurrentQueue *, void *);
+
+/**
+ * Pop an element off the front of the queue, or return NULL right
+ * away if the queue is empty.
+ */
+extern void * ConcurrentQueuePop(ConcurrentQueue *);
+
+/**
+ * Pop an element off the front of the queue, waiting up to the given
+ * number of milliseconds for one to be pushed if the queue is empty,
+ * or for as long as it takes if the timeout is negative. This returns
+ * NULL if the timeout expires, or if
+ * .Fn ConcurrentQueueWake
+ * is called first.
+ */
+extern void * ConcurrentQueueWait(ConcurrentQueue *, long);
+
+/**
+ * Make all of the threads that are currently blocked in
+ * .Fn ConcurrentQueueWait
+ * on the given queue return NULL, such as when shutting down.
+ */
+extern void ConcurrentQueueWake(ConcurrentQueue *);
+
+/**
+ * Determine whether or not the next push onto the queue would fail
+ * because the queue is full. With more than one thread pushing, this
+ * can be out of date by the time it returns, but when only one thread
+ * pushes onto the queue, a push after this returns false always
+ * succeeds.
+ */
+extern bool ConcurrentQueueFull(ConcurrentQueue *);
+
+/**
+ * Determine whether or not the queue is empty. Like
+ * .Fn ConcurrentQueueFull ,
+ * this can be out of date by the time it returns.
+ */
+extern bool ConcurrentQueueEmpty(ConcurrentQueue *);
+
+#endif                             /* CYTOPLASM_CONCURRENTQUEUE_H */
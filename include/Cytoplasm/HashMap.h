@@ -54,17 +54,66 @@
  */
 typedef struct HashMap HashMap;
 
+/**
+ * The ways in which a hash map can hold on to its keys:
+ * .Bl -tag -width Ds
+ * .It Dv HASHMAP_KEYS_COPY
+ * Every key that is set is copied into memory owned by the map. This
+ * is what
+ * .Fn HashMapCreate
+ * gives you, and the caller keeps its own key.
+ * .It Dv HASHMAP_KEYS_OWN
+ * The map takes ownership of every key that is set, which must have
+ * been allocated with the Memory API. If the key is already in the
+ * map, or it can't be added, the given key is freed right away, so
+ * the caller must not use it after the call either way.
+ * .It Dv HASHMAP_KEYS_BORROW
+ * The map only references the keys that are set, and never frees
+ * them. The keys must stay valid and unchanged for as long as they
+ * are in the map, which makes this mode suited to string literals,
+ * interned strings, and strings that live in a memory arena.
+ * .El
+ */
+typedef enum HashMapKeyMode
+{
+    HASHMAP_KEYS_COPY,
+    HASHMAP_KEYS_OWN,
+    HASHMAP_KEYS_BORROW
+} HashMapKeyMode;
+
 /**
  * Create a new hash map that is ready to be used with the rest of the
  * functions defined here.
  */
 extern HashMap * HashMapCreate(void);
 
+/**
+ * Create a new hash map like
+ * .Fn HashMapCreate
+ * does, but which holds on to its keys in the given way.
+ */
+extern HashMap * HashMapCreateMode(HashMapKeyMode);
+
+/**
+ * Change the way a hash map holds on to the keys that are set from
+ * now on. A map that owns its keys frees them all the same, so a map
+ * can be switched between
+ * .Dv HASHMAP_KEYS_COPY
+ * and
+ * .Dv HASHMAP_KEYS_OWN
+ * at any time; a parser can, for instance, hand the keys it allocates
+ * over to a map, and then switch it to copying before giving it to
+ * code that sets keys of its own. Switching to or from
+ * .Dv HASHMAP_KEYS_BORROW
+ * is only possible while the map is empty, and is ignored otherwise.
+ */
+extern void HashMapKeyModeSet(HashMap *, HashMapKeyMode);
+
 /**
  * Free the specified hash map such that it becomes invalid and any
  * future use results in undefined behavior. Note that this function
- * does not free the values stored in the hash map, but since it stores
- * the keys internally, it will free the keys. You should use
+ * does not free the values stored in the hash map, but unless the map
+ * borrows its keys, it owns them, so it will free the keys. You should use
  * .Fn HashMapIterate
  * to free the values stored in this map appropriately before calling
  * this function.
@@ -97,20 +146,65 @@ extern void HashMapMaxLoadSet(HashMap *, float);
  * .Pp
  * The hash function takes a pointer to a C string, and is expected
  * to return a fairly unique numerical hash value which will be
- * converted into an array index.
+ * converted into an array index. The low bits of the hash select the
+ * bucket, so they should be well distributed. Keys whose hashes are
+ * equal are still told apart by comparing them.
  */
 extern void
 HashMapFunctionSet(HashMap *, unsigned long (*) (const char *));
 
 /**
- * Set the given string key to the given value. Note that the key is
- * copied into the hash map's own memory space, but the value is not.
+ * The hash function that new hash maps use. It reads keys a word at a
+ * time, so it is fast on long keys, and it is seeded with random
+ * bytes when the first hash map in the process is created, so that
+ * nobody can choose keys that collide in order to slow a map down.
+ * Because of that, the hash of a key, and the order in which
+ * .Fn HashMapIterate
+ * goes over a map, differ from one process to the next.
+ */
+extern unsigned long HashMapHash(const char *);
+
+/**
+ * The FNV-1a hash function, which hash maps used by default before
+ * .Fn HashMapHash .
+ * It reads keys a byte at a time and isn't seeded, so the same key
+ * always has the same hash. It can be set with
+ * .Fn HashMapFunctionSet
+ * on maps that never hold keys which come from outside the program.
+ */
+extern unsigned long HashMapHashFnv(const char *);
+
+/**
+ * Set the given string key to the given value. Note that by default
+ * the key is copied into the hash map's own memory space, but the
+ * value is not; see
+ * .Fn HashMapCreateMode
+ * for maps that take or borrow their keys instead.
  * It is the caller's job to ensure that the value pointer remains
  * valid for the life of the hash map, and are freed when no longer
  * needed.
  */
 extern void * HashMapSet(HashMap *, char *, void *);
 
+/**
+ * Make sure that the given hash map has room for at least the given
+ * number of keys in total, so that setting keys up to that number
+ * doesn't have to grow the map. Maps grow by doubling on their own,
+ * so this is never required, but it saves moving the keys along the
+ * way when the final number of keys is known up front. This function
+ * returns a boolean value indicating whether or not it succeeded.
+ * .Pp
+ * Maps also shrink on their own, when most of their keys have been
+ * deleted.
+ */
+extern bool HashMapReserve(HashMap *, size_t);
+
+/**
+ * Return the number of keys in the given hash map. This doesn't have
+ * to go over the map to count them.
+ */
+extern size_t HashMapCount(HashMap *);
+
 /**
  * Retrieve the value for the given key, or return NULL if no such
  * key exists in the hash map.
@@ -133,6 +227,10 @@ extern void * HashMapDelete(HashMap *, const char *);
  * rely on globals; it takes pointer pointers, and stores all
  * necessary state inside the hash map itself.
  * .Pp
+ * The keys are visited in the order in which they were first set.
+ * Setting a key that is already in the map doesn't move it, but a
+ * key that is deleted and set again moves to the end.
+ * .Pp
  * Note that this function is not thread-safe; two threads cannot be
  * iterating over any given hash map at the same time, though they
  * can each be iterating over different hash maps.
@@ -44,6 +44,7 @@
 
 #include "HashMap.h"
 #include "Stream.h"
+#include "Memory.h"
 
 #define HTTP_FLAG_NONE 0
 #define HTTP_FLAG_TLS (1 << 0)
@@ -188,6 +189,20 @@ extern char * HttpUrlDecode(char *);
  */
 extern HashMap * HttpParamDecode(char *);
 
+/**
+ * This function is identical to
+ * .Fn HttpParamDecode ,
+ * except that the decoded keys and values are allocated from the given arena
+ * instead of the heap. They must not be freed individually; they are
+ * released along with the arena. The returned map borrows its keys, so
+ * any key that is set in it must outlive the arena as well; see
+ * .Fn HashMapCreateMode .
+ * If the arena is NULL, this function
+ * behaves exactly like
+ * .Fn HttpParamDecode .
+ */
+extern HashMap * HttpParamDecodeArena(char *, MemoryArena *);
+
 /**
  * Encode a hash map whose values are strings as an HTTP parameter
  * string suitable for GET or POST requests.
@@ -208,4 +223,18 @@ extern char * HttpParamEncode(HashMap *);
  */
 extern HashMap * HttpParseHeaders(Stream *);
 
+/**
+ * This function is identical to
+ * .Fn HttpParseHeaders ,
+ * except that the header keys and values are allocated from the given arena
+ * instead of the heap. They must not be freed individually; they are
+ * released along with the arena. The returned map borrows its keys, so
+ * any key that is set in it must outlive the arena as well; see
+ * .Fn HashMapCreateMode .
+ * If the arena is NULL, this function
+ * behaves exactly like
+ * .Fn HttpParseHeaders .
+ */
+extern HashMap * HttpParseHeadersArena(Stream *, MemoryArena *);
+
 #endif
@@ -52,6 +52,7 @@
 #include "Http.h"
 #include "HashMap.h"
 #include "Stream.h"
+#include "Memory.h"
 
 /**
  * The functions on this API operate on an opaque structure.
@@ -231,4 +232,19 @@ extern void HttpSendHeaders(HttpServerContext *);
  */
 extern Stream * HttpServerStream(HttpServerContext *);
 
+/**
+ * Get the memory arena for the request represented by the given
+ * context. Handlers may allocate any temporary data they need while
+ * handling the request from this arena using
+ * .Fn MemoryArenaAllocate ,
+ * instead of allocating and freeing each object on the heap. All of
+ * it is released at once after the handler returns, so nothing
+ * allocated from the arena may outlive the request. The request
+ * headers, path, and parameters are also allocated from this arena.
+ * .Pp
+ * Values allocated from this arena may also be used as response
+ * headers; the server will not attempt to free them.
+ */
+extern MemoryArena * HttpServerArena(HttpServerContext *);
+
 #endif /* CYTOPLASM_HTTPSERVER_H */
@@ -59,6 +59,7 @@
 #include <stdarg.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #ifndef IO_BUFFER
 #define IO_BUFFER 4096
@@ -93,6 +94,16 @@ typedef ssize_t (IoReadFunc) (void *, void *, size_t);
  */
 typedef ssize_t (IoWriteFunc) (void *, void *, size_t);
 
+/**
+ * Write output to a sink from several buffers at once. This function
+ * is optional; it should behave identically to the POSIX
+ * .Xr writev 2
+ * system call, except instead of using an integer descriptor as the
+ * first parameter, a pointer to an implementation-defined cookie
+ * stores any information the function needs to write to the sink.
+ */
+typedef ssize_t (IoWritevFunc) (void *, const struct iovec *, int);
+
 /**
  * Repositions the offset of the stream described by the specified
  * cookie. This function should behave identically to the POSIX
@@ -151,6 +162,32 @@ extern ssize_t IoRead(Io *, void *, size_t);
  */
 extern ssize_t IoWrite(Io *, void *, size_t);
 
+/**
+ * Give the specified stream a function to write several buffers at
+ * once with. This is separate from
+ * .Fn IoCreate
+ * so that existing
+ * .Nm IoFunctions
+ * structures don't need another member to be filled in.
+ */
+extern void IoWritevSet(Io *, IoWritevFunc *);
+
+/**
+ * Write the specified number of buffers, described by the specified
+ * array of
+ * .Nm iovec
+ * structures, to the specified stream in order. This calls the
+ * stream's IoWritevFunc, if it has one, which should behave
+ * identically to the POSIX
+ * .Xr writev 2
+ * system call. Otherwise, the buffers are written one at a time with
+ * its IoWriteFunc, stopping at the first short write, so the result
+ * is the same as that of
+ * .Xr writev 2 ,
+ * if not as efficient.
+ */
+extern ssize_t IoWritev(Io *, const struct iovec *, int);
+
 /**
  * Seek the specified stream using the specified offset and whence
  * value. This calls the stream's underlying IoSeekFunc, which should
@@ -219,4 +256,26 @@ extern Io * IoOpen(const char *, int, mode_t);
  */
 extern Io * IoFile(FILE *);
 
+/**
+ * Create an Io that writes into a buffer in memory, much like
+ * .Xr open_memstream 3 .
+ * The buffer grows as it is written to, and after every write, the
+ * given pointers hold its address and the number of bytes in it. The
+ * buffer is always followed by a NUL byte, which is not counted. It is
+ * allocated with the Memory API, and belongs to the caller, who
+ * should
+ * .Fn Free
+ * it after closing the Io. The Io can also seek within what was
+ * written and read it back.
+ */
+extern Io * IoMemory(char **, size_t *);
+
+/**
+ * Create an Io that reads the given bytes, much like
+ * .Xr fmemopen 3
+ * in read mode. The bytes are not copied, so they must stay valid
+ * until the Io is closed. The Io can seek, but can't be written to.
+ */
+extern Io * IoFromBuffer(const void *, size_t);
+
 #endif                             /* CYTOPLASM_IO_H */
@@ -50,12 +50,11 @@
  * This JSON implementation focuses primarily on serialization and
  * deserialization to and from streams. It does not provide facilities
  * for handling JSON strings; it only writes JSON to output streams,
- * and reads them from input streams. Of course, you can use the
- * POSIX
- * .Xr fmemopen 3
+ * and reads them from input streams. Of course, you can use
+ * .Fn StreamFromBuffer
  * and
- * .Xr open_memstream 3
- * functions if you want to deal with JSON strings, but JSON is
+ * .Fn StreamMemory
+ * if you want to deal with JSON strings, but JSON is
  * intended to be an exchange format. Data should be converted to JSON
  * right when it is leaving the program, and converted from JSON to the
  * in-memory format as soon as it is coming in.
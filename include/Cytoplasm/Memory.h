@@ -46,6 +46,21 @@
  * callback function can be executed every time a memory operation
  * occurs.
  * .Pp
+ * How much of this is available depends on the memory tracking level
+ * Cytoplasm was built with. With full tracking, which is the default,
+ * everything described here works. With tracking reduced to counters,
+ * .Fn MemoryAllocated
+ * still works, but
+ * .Fn MemoryIterate
+ * does nothing, no file names or line numbers are recorded, and the
+ * hook is only executed for bad pointers. With tracking turned off,
+ * .Fn MemoryAllocated
+ * always returns 0 as well. In every case,
+ * .Fn MemoryInfoGet
+ * and
+ * .Fn MemoryInfoGetSize
+ * continue to work.
+ * .Pp
  * In the future, this API could include a garbage collector that
  * automatically frees memory it detects as being no longer in use.
  * However, this feature does not yet exist.
@@ -91,7 +106,37 @@ typedef enum MemoryAction
     MEMORY_CORRUPTED
 } MemoryAction;
 
+/**
+ * Allocations can be tagged with the subsystem they belong to, so
+ * that the memory held by each subsystem can be monitored while the
+ * program runs. Untagged allocations are not counted.
+ */
+typedef enum MemoryTag
+{
+    MEMORY_TAG_NONE,
+    MEMORY_TAG_DB,
+    MEMORY_TAG_JSON,
+    MEMORY_TAG_HTTP,
+    MEMORY_TAG_STREAM,
+    MEMORY_TAG_LOG,
+    MEMORY_TAG_COUNT
+} MemoryTag;
+
+/**
+ * The counters kept for each tag. Rates can be computed from the
+ * cumulative counters by sampling them at an interval.
+ */
+typedef struct MemoryTagStats
+{
+    size_t live;                   /* Bytes currently allocated */
+    size_t peak;                   /* Largest value of live so far */
+    size_t allocations;            /* Allocations made, cumulative */
+    size_t bytes;                  /* Bytes allocated, cumulative */
+} MemoryTagStats;
+
 #define Malloc(x) MemoryAllocate(x, __FILE__, __LINE__)
+#define MallocTagged(x, t) MemoryAllocateTagged(x, t, __FILE__, __LINE__)
+#define MallocAligned(x, a) MemoryAllocateAligned(x, a, __FILE__, __LINE__)
 #define Realloc(x, s) MemoryReallocate(x, s, __FILE__, __LINE__)
 #define Free(x) MemoryFree(x, __FILE__, __LINE__)
 
@@ -107,16 +152,46 @@ typedef struct MemoryInfo MemoryInfo;
  * .Xr malloc 3 ,
  * except that it takes the file name and line number at which the
  * allocation occurred.
+ * .Pp
+ * The file name is not copied; only the pointer is kept, and it is
+ * returned by
+ * .Fn MemoryInfoGetFile
+ * for as long as the block lives. It must therefore have static
+ * storage duration, like the __FILE__ string that the
+ * .Fn Malloc
+ * macro passes.
  */
 extern void * MemoryAllocate(size_t, const char *, int);
 
+/**
+ * Allocate the specified number of bytes on the heap, and charge them
+ * to the given tag. This is otherwise identical to
+ * .Fn MemoryAllocate .
+ * The tag stays with the block when it is reallocated.
+ */
+extern void * MemoryAllocateTagged(size_t, MemoryTag, const char *, int);
+
+/**
+ * Allocate the specified number of bytes on the heap, such that the
+ * returned pointer is a multiple of the given alignment, which must
+ * be a power of two. This is otherwise identical to
+ * .Fn MemoryAllocate ,
+ * and the block is reallocated and freed the same way as any other.
+ * A reallocated block keeps its alignment.
+ * .Pp
+ * This function returns NULL if the alignment isn't a power of two.
+ */
+extern void * MemoryAllocateAligned(size_t, size_t, const char *, int);
+
 /**
  * Change the size of the object pointed to by the given pointer
  * to the given number of bytes. This function has the same semantics
  * as
  * .Xr realloc 3 ,
  * except that it takes the file name and line number at which the
- * reallocation occurred.
+ * reallocation occurred. The file name must have static storage
+ * duration, just as with
+ * .Fn MemoryAllocate .
  */
 extern void * MemoryReallocate(void *, size_t, const char *, int);
 
@@ -125,7 +200,9 @@ extern void * MemoryReallocate(void *, size_t, const char *, int);
  * semantics as
  * .Xr free 3 ,
  * except that it takes the file name and line number at which the
- * free occurred.
+ * free occurred. The file name must have static storage duration,
+ * just as with
+ * .Fn MemoryAllocate .
  */
 extern void MemoryFree(void *, const char *, int);
 
@@ -137,6 +214,29 @@ extern void MemoryFree(void *, const char *, int);
  */
 extern size_t MemoryAllocated(void);
 
+/**
+ * Charge the block at the given pointer to the given tag instead of
+ * the one it was allocated with. This is useful for blocks that are
+ * allocated by other APIs, such as the strings returned by
+ * .Fn StrDuplicate .
+ */
+extern void MemoryTagSet(void *, MemoryTag);
+
+/**
+ * Take a snapshot of the counters for the given tag. The counters are
+ * read individually without stopping other threads, so they may be
+ * slightly out of step with each other. This function returns a
+ * boolean value indicating whether or not the tag is valid. It works
+ * at every memory tracking level.
+ */
+extern int MemoryTagStatsGet(MemoryTag, MemoryTagStats *);
+
+/**
+ * Get a short, lowercase name for the given tag, suitable for use as
+ * a metric label, or NULL if the tag is not valid.
+ */
+extern const char * MemoryTagName(MemoryTag);
+
 /**
  * Iterate over all heap allocations made with
  * .Fn MemoryAllocate
@@ -155,7 +255,13 @@ extern void MemoryFreeAll(void);
  * . Nm
  * knows about the pointer, it returns a structure that can be used
  * to obtain information about the block of memory that the pointer
- * points to.
+ * points to. Otherwise, it returns NULL.
+ * .Pp
+ * Any pointer at all may be passed to this function, including
+ * pointers into the stack, into static storage, or into memory that
+ * was never mapped. Only pointers returned by this API, and not yet
+ * freed, are looked up; anything else is rejected without being
+ * dereferenced. Lookups never take a lock.
  */
 extern MemoryInfo * MemoryInfoGet(void *);
 
@@ -177,6 +283,12 @@ extern const char * MemoryInfoGetFile(MemoryInfo *);
  */
 extern int MemoryInfoGetLine(MemoryInfo *);
 
+/**
+ * Get the tag that the block represented by the given memory info
+ * structure is charged to.
+ */
+extern MemoryTag MemoryInfoGetTag(MemoryInfo *);
+
 /**
  * Get a pointer to the block of memory represented by the specified
  * memory info structure.
@@ -197,6 +309,10 @@ extern void MemoryIterate(void (*) (MemoryInfo *, void *), void *);
  * occurred on the block of memory represented by the memory info
  * structure. The function also takes a void pointer to caller-provided
  * arguments.
+ * .Pp
+ * Allocations are tracked per thread, so the hook is not serialized;
+ * it may be executed by several threads at the same time and must be
+ * thread-safe.
  */
 extern void MemoryHook(void (*) (MemoryAction, MemoryInfo *, void *), void *);
 
@@ -233,4 +349,167 @@ extern void MemoryDefaultHook(MemoryAction, MemoryInfo *, void *);
 extern void
 MemoryHexDump(MemoryInfo *, void (*) (size_t, char *, char *, void *), void *);
 
+/**
+ * The formats in which a heap profile can be written.
+ */
+typedef enum MemoryProfileFormat
+{
+    MEMORY_PROFILE_PPROF,
+    MEMORY_PROFILE_COLLAPSED
+} MemoryProfileFormat;
+
+/**
+ * Start the sampling heap profiler. Unlike
+ * .Fn MemoryIterate ,
+ * which visits every block, the profiler only records about one
+ * allocation for every given number of bytes allocated, along with a
+ * backtrace where the platform supports it. Samples are aggregated by
+ * the file and line that allocated them, so a profile stays small no
+ * matter how large the heap is, and the overhead is low enough to
+ * leave the profiler running in production. Passing 0 selects the
+ * default of one sample every 512 KiB. The profiler works at every
+ * memory tracking level.
+ */
+extern void MemoryProfileStart(size_t);
+
+/**
+ * Stop taking new samples. Blocks that were already sampled are still
+ * accounted for when they are freed, so the profile remains accurate
+ * for them.
+ */
+extern void MemoryProfileStop(void);
+
+/**
+ * Write the current heap profile to the given file descriptor in the
+ * given format. The
+ * .Dv MEMORY_PROFILE_PPROF
+ * format is the legacy text heap profile read by
+ * .Xr pprof 1 ,
+ * which scales the samples back up by itself. The
+ * .Dv MEMORY_PROFILE_COLLAPSED
+ * format has one line per call site, containing the stack of the
+ * first sample taken there and the estimated number of live bytes,
+ * which is what flame graph tools expect. Only the memory the
+ * profiler needs for this is allocated, and it is not taken from the
+ * Memory API. This function returns a boolean value indicating
+ * whether or not the whole profile was written.
+ */
+extern int MemoryProfileWrite(int, MemoryProfileFormat);
+
+/**
+ * Write the heap profile to the file at the given path, in the given
+ * format, every time the process receives the given signal. The
+ * profile is written from a separate thread, not from the signal
+ * handler. This can only be set up once; it returns a boolean value
+ * indicating whether or not it was.
+ */
+extern int MemoryProfileSignal(int, const char *, MemoryProfileFormat);
+
+/**
+ * How close the program is to its memory budget.
+ */
+typedef enum MemoryPressure
+{
+    MEMORY_PRESSURE_NONE,
+    MEMORY_PRESSURE_SOFT,
+    MEMORY_PRESSURE_HARD
+} MemoryPressure;
+
+/**
+ * Set a soft and a hard limit on the number of bytes the program
+ * allocates. Either may be 0 to leave it unset, and setting both to
+ * 0 lifts the budget. Only blocks allocated while a budget is set
+ * count against it, so it should be set early on. Usage is tallied
+ * per thread and only published every 64 KiB, so it may be off by
+ * that much per thread, but in exchange the budget adds no contention
+ * to allocations. This function returns a boolean value indicating
+ * whether or not the limits were valid and the budget could be set.
+ */
+extern int MemoryBudgetSet(size_t, size_t);
+
+/**
+ * Get the number of bytes currently counted against the budget.
+ */
+extern size_t MemoryBudgetUsage(void);
+
+/**
+ * Get the current pressure level, which is
+ * .Dv MEMORY_PRESSURE_HARD
+ * when usage is at or above the hard limit,
+ * .Dv MEMORY_PRESSURE_SOFT
+ * when it is at or above the soft limit, and
+ * .Dv MEMORY_PRESSURE_NONE
+ * otherwise.
+ */
+extern MemoryPressure MemoryPressureGet(void);
+
+/**
+ * Register a function to be called with the new pressure level every
+ * time it changes, along with the given argument. Callbacks are run
+ * one at a time on a dedicated thread, never from inside an
+ * allocation, so they may take locks and allocate or free memory.
+ * They must not register or unregister callbacks themselves. This
+ * function returns a boolean value indicating whether or not the
+ * callback was registered.
+ */
+extern int MemoryPressureRegister(void (*) (MemoryPressure, void *), void *);
+
+/**
+ * Remove a callback registered with the same function and argument.
+ * Once this returns, the callback is not running and will not be
+ * called again, so this must not be called while holding a lock that
+ * the callback takes.
+ */
+extern void MemoryPressureUnregister(void (*) (MemoryPressure, void *), void *);
+
+/**
+ * An arena is a region of memory from which many small objects can be
+ * allocated quickly and then released all at once. This is useful
+ * when a group of objects share the same lifetime, such as all the
+ * temporary data used while handling a single request.
+ */
+typedef struct MemoryArena MemoryArena;
+
+/**
+ * Create a new arena. Memory is obtained from the heap in chunks of
+ * the given size, and handed out by simply advancing a pointer
+ * through the current chunk. Passing 0 selects a sensible default
+ * chunk size. The chunks themselves are allocated with
+ * .Fn Malloc ,
+ * so they still show up in memory reports.
+ */
+extern MemoryArena * MemoryArenaCreate(size_t);
+
+/**
+ * Allocate the specified number of bytes from the given arena. The
+ * returned pointer is suitably aligned for any type, but it must
+ * never be passed to
+ * .Fn Free
+ * or
+ * .Fn Realloc ;
+ * it remains valid until the arena is reset or freed. This function
+ * returns NULL if the arena could not obtain a new chunk.
+ */
+extern void * MemoryArenaAllocate(MemoryArena *, size_t);
+
+/**
+ * Determine whether or not the given pointer was allocated from the
+ * given arena. This takes time proportional to the number of chunks
+ * in the arena, not the number of allocations made from it.
+ */
+extern int MemoryArenaContains(MemoryArena *, void *);
+
+/**
+ * Release everything allocated from the given arena at once, but keep
+ * one chunk around so that the arena can be reused without going back
+ * to the heap.
+ */
+extern void MemoryArenaReset(MemoryArena *);
+
+/**
+ * Release everything allocated from the given arena, as well as the
+ * arena itself.
+ */
+extern void MemoryArenaFree(MemoryArena *);
+
 #endif
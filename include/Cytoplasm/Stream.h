@@ -80,6 +80,30 @@ extern Stream * StreamFile(FILE *);
  */
 extern Stream * StreamOpen(const char *, const char *);
 
+/**
+ * Create a new stream that writes into a buffer in memory. This is a
+ * convenience function for calling
+ * .Fn IoMemory
+ * and then passing the result into
+ * .Fn StreamIo .
+ * Since the stream is buffered, the given pointers are only up to date
+ * once it is flushed or closed. The caller should
+ * .Fn Free
+ * the buffer when done with it.
+ */
+extern Stream * StreamMemory(char **, size_t *);
+
+/**
+ * Create a new stream that reads the given bytes. Unlike passing
+ * .Fn IoFromBuffer
+ * into
+ * .Fn StreamIo ,
+ * the stream reads the bytes where they are instead of copying them
+ * into a buffer of its own, so they must stay valid until the stream
+ * is closed.
+ */
+extern Stream * StreamFromBuffer(const void *, size_t);
+
 /**
  * Get a stream that writes to the standard output.
  */
@@ -159,6 +183,69 @@ extern int StreamPuts(Stream *, char *);
  */
 extern char * StreamGets(Stream *, char *, int);
 
+/**
+ * Read up to the specified number of bytes from the specified stream
+ * into the memory located at the specified pointer. This function is
+ * analogous to the standard
+ * .Xr fread 3
+ * function: it only returns fewer bytes than were asked for at the
+ * end of the stream or on an error, which
+ * .Fn StreamEof
+ * and
+ * .Fn StreamError
+ * tell apart. Buffered bytes are copied over in bulk, and large reads
+ * go straight into the given memory.
+ */
+extern ssize_t StreamRead(Stream *, void *, size_t);
+
+/**
+ * Write the specified number of bytes from the memory located at the
+ * specified pointer to the specified stream. This function is
+ * analogous to the standard
+ * .Xr fwrite 3
+ * function. Small writes are copied into the buffer of the stream in
+ * bulk, and large ones are written straight from the given memory.
+ * It returns the number of bytes written, or -1 on an error.
+ */
+extern ssize_t StreamWrite(Stream *, const void *, size_t);
+
+/**
+ * Write the specified number of buffers, described by the specified
+ * array of
+ * .Nm iovec
+ * structures, to the specified stream in order, like the POSIX
+ * .Xr writev 2
+ * system call. Small buffers are copied into the buffer of the stream,
+ * while large ones are handed to the underlying
+ * .Xr Io 3
+ * as they are, along with whatever was buffered before them, so that
+ * a response head and its body can go out in a single system call,
+ * without the body being copied. This returns the total number of
+ * bytes written, or -1 on an error.
+ */
+extern ssize_t StreamWritev(Stream *, const struct iovec *, int);
+
+/**
+ * Look at the bytes that can be read from the specified stream
+ * without consuming them, reading more into the buffer of the stream
+ * if it is empty. This sets the given pointer to the bytes, and
+ * returns how many there are, or 0 at the end of the stream or on an
+ * error. The bytes stay valid until the next call that reads from
+ * the stream.
+ * .Pp
+ * This lets a parser scan for the end of a token right in the buffer
+ * of the stream, and take everything up to it in one go with
+ * .Fn StreamConsume .
+ */
+extern size_t StreamPeek(Stream *, const char **);
+
+/**
+ * Consume the specified number of the bytes last returned by
+ * .Fn StreamPeek ,
+ * as if they had been read.
+ */
+extern void StreamConsume(Stream *, size_t);
+
 /**
  * Set the file position indicator for the specified stream. This
  * function is analogous to the standard
@@ -206,10 +293,21 @@ extern int StreamFlush(Stream *);
  * Read all the bytes from the first stream and write them to the
  * second stream. This is analogous to
  * .Fn IoCopy ,
- * but it uses the internal buffers of the streams. It is probably
- * less efficient than doing a
- * .Fn IoCopy
- * instead, but it is more convenient.
+ * but it uses the internal buffers of the streams, and copies
+ * whatever is in the buffer of the first stream in one go.
+ * .Pp
+ * If both streams were created with
+ * .Fn StreamFd ,
+ * the kernel is asked to move the bytes from one file descriptor to
+ * the other without copying them through the buffers, with
+ * .Xr copy_file_range 2 ,
+ * .Xr sendfile 2
+ * or
+ * .Xr splice 2
+ * where they are available, and a full output is waited on with
+ * .Xr poll 2
+ * rather than given up on. In that case, this function returns -1
+ * if the copy failed before any bytes were moved.
  */
 extern ssize_t StreamCopy(Stream *, Stream *);
 
@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef CYTOPLASM_VECTOR_H
+#define CYTOPLASM_VECTOR_H
+
+/***
+ * @Nm Vector
+ * @Nd A dynamic array that stores its elements inline.
+ * @Dd October 16 2026
+ * @Xr Array
+ *
+ * A
+ * .Nm
+ * is a dynamic array like
+ * .Xr Array 3 ,
+ * except that it stores copies of its elements, all of the same size,
+ * in one contiguous block of memory, rather than pointers to them.
+ * Integers, structures and other small values can thus be kept in a
+ * vector without allocating each of them separately, and going over
+ * the elements in order reads memory in order.
+ * .Pp
+ * The flip side is that the elements move when the vector grows, so
+ * pointers to them are only valid until the next call that adds an
+ * element, unless enough room was reserved beforehand with
+ * .Fn VectorReserve .
+ */
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/**
+ * The functions in this API operate on a vector structure which is
+ * opaque to the caller.
+ */
+typedef struct Vector Vector;
+
+/**
+ * Allocate a new vector whose elements are the given number of bytes
+ * in size. This function returns NULL if there was an error
+ * allocating memory for the vector, or the size is 0.
+ */
+extern Vector * VectorCreate(size_t);
+
+/**
+ * Allocate a new vector whose elements are of the given type.
+ */
+#define VectorCreateOf(type) VectorCreate(sizeof(type))
+
+/**
+ * Deallocate a vector, along with the elements in it.
+ */
+extern void VectorFree(Vector *);
+
+/**
+ * Get the number of elements in the given vector.
+ */
+extern size_t VectorSize(Vector *);
+
+/**
+ * Get a pointer to the element at the given index in the given
+ * vector, or NULL if the vector is NULL or the index is out of
+ * bounds. The element can be read and written through this pointer.
+ */
+extern void * VectorGet(Vector *, size_t);
+
+/**
+ * Get a pointer of the given type to the element at the given index
+ * in the given vector, or NULL.
+ */
+#define VectorAt(vector, type, index) ((type *) VectorGet(vector, index))
+
+/**
+ * Get a pointer to the first element of the given vector. The elements
+ * are stored one after another, so this can be used as a C array of
+ * as many elements as
+ * .Fn VectorSize
+ * returns. This returns NULL if the vector is empty.
+ */
+extern void * VectorData(Vector *);
+
+/**
+ * Copy the element pointed to by the last argument into the given
+ * vector at the given index, shifting the element at that index and
+ * all the elements after it up by one. The element may be one of the
+ * vector's own, as returned by
+ * .Fn VectorGet ,
+ * even if the vector has to grow to make room for it. This function
+ * returns a boolean value indicating whether or not it succeeded.
+ */
+extern bool VectorInsert(Vector *, size_t, const void *);
+
+/**
+ * Copy the element pointed to by the last argument onto the end of
+ * the given vector. This function has the same return value as
+ * .Fn VectorInsert .
+ */
+extern bool VectorAdd(Vector *, const void *);
+
+/**
+ * Copy the given number of elements, stored one after another at the
+ * given location, onto the end of the given vector, all at once. As
+ * with
+ * .Fn VectorInsert ,
+ * they may be the vector's own elements. This
+ * function returns a boolean value indicating whether or not it
+ * succeeded; if it didn't, the vector is left unchanged.
+ */
+extern bool VectorAddAll(Vector *, const void *, size_t);
+
+/**
+ * Overwrite the element at the given index in the given vector with
+ * a copy of the element pointed to by the last argument. This
+ * function returns false if the index is out of bounds.
+ */
+extern bool VectorSet(Vector *, size_t, const void *);
+
+/**
+ * Remove the element at the given index from the given vector,
+ * shifting the elements after it down by one. If the last argument
+ * isn't NULL, the removed element is copied there first. This
+ * function returns false if the index is out of bounds.
+ */
+extern bool VectorDelete(Vector *, size_t, void *);
+
+/**
+ * Make sure that the given vector has room for at least the given
+ * number of elements in total, so that adding elements up to that
+ * number neither allocates memory nor moves the elements. This
+ * function returns a boolean value indicating whether or not it
+ * succeeded.
+ */
+extern bool VectorReserve(Vector *, size_t);
+
+/**
+ * If possible, reduce the amount of memory allocated to the given
+ * vector to fit the elements in it exactly, like
+ * .Fn ArrayTrim
+ * does for arrays.
+ */
+extern bool VectorTrim(Vector *);
+
+/**
+ * Sort the elements of the given vector in place with the given
+ * comparison function, which is passed pointers to two elements and
+ * works like the one that
+ * .Xr qsort 3
+ * takes.
+ */
+extern void VectorSort(Vector *, int (*) (const void *, const void *));
+
+/**
+ * Duplicate an existing vector, elements and all.
+ */
+extern Vector * VectorDuplicate(Vector *);
+
+#endif                             /* CYTOPLASM_VECTOR_H */
@@ -28,6 +28,10 @@
 #endif
 
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
 #include <Memory.h>
 
 struct Array
@@ -38,6 +42,99 @@ struct Array
     size_t size;                   /* Elements actually filled */
 };
 
+/*
+ * An array can only be given a memory tag after ArrayCreate()
+ * allocated its entries, so bring them in line with it before the
+ * first element goes in. They keep the tag when they are reallocated.
+ */
+static void
+ArrayTag(Array * array)
+{
+    if (!array->size)
+    {
+        MemoryTagSet(array->entries, MemoryInfoGetTag(MemoryInfoGet(array)));
+    }
+}
+
+/*
+ * Make room for at least the given number of elements. Arrays grow
+ * geometrically, so that appending n elements one at a time copies
+ * O(n) elements in all, rather than O(n^2).
+ */
+static bool
+ArrayGrow(Array * array, size_t need)
+{
+    size_t newSize = array->allocated ? array->allocated : ARRAY_BLOCK;
+    void **tmp;
+
+    if (need <= array->allocated)
+    {
+        return true;
+    }
+
+    if (need > SIZE_MAX / sizeof(void *))
+    {
+        return false;
+    }
+
+    while (newSize < need)
+    {
+        newSize = (newSize > SIZE_MAX / sizeof(void *) / 2) ? need : newSize * 2;
+    }
+
+    tmp = Realloc(array->entries, sizeof(void *) * newSize);
+    if (!tmp)
+    {
+        return false;
+    }
+
+    array->entries = tmp;
+    array->allocated = newSize;
+    return true;
+}
+
+bool
+ArrayReserve(Array * array, size_t size)
+{
+    if (!array)
+    {
+        return false;
+    }
+
+    ArrayTag(array);
+    return ArrayGrow(array, size);
+}
+
+bool
+ArrayAddAll(Array * array, void **values, size_t n)
+{
+    size_t i;
+
+    if (!array || (n && !values))
+    {
+        return false;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        if (!values[i])
+        {
+            return false;
+        }
+    }
+
+    ArrayTag(array);
+    if (!ArrayGrow(array, array->size + n))
+    {
+        return false;
+    }
+
+    memcpy(array->entries + array->size, values, n * sizeof(void *));
+    array->size += n;
+
+    return true;
+}
+
 bool
 ArrayAdd(Array * array, void *value)
 {
@@ -92,6 +189,23 @@ ArrayDelete(Array * array, size_t index)
 
     array->size--;
 
+    /*
+     * Give back memory after mass deletions. The array is only shrunk
+     * to twice its size, so that it doesn't have to grow again right
+     * away.
+     */
+    if (array->allocated > ARRAY_BLOCK && array->size < array->allocated / 4)
+    {
+        size_t newSize = array->allocated / 2;
+        void **tmp = Realloc(array->entries, sizeof(void *) * newSize);
+
+        if (tmp)
+        {
+            array->entries = tmp;
+            array->allocated = newSize;
+        }
+    }
+
     return element;
 }
 
@@ -132,23 +246,11 @@ ArrayInsert(Array * array, size_t index, void *value)
         return false;
     }
 
-    if (array->size >= array->allocated)
-    {
-        void **tmp;
-        size_t newSize = array->allocated + ARRAY_BLOCK;
-
-        tmp = array->entries;
+    ArrayTag(array);
 
-        array->entries = Realloc(array->entries,
-                                 sizeof(void *) * newSize);
-
-        if (!array->entries)
-        {
-            array->entries = tmp;
-            return false;
-        }
-
-        array->allocated = newSize;
+    if (!ArrayGrow(array, array->size + 1))
+    {
+        return false;
     }
 
     for (i = array->size; i > index; i--)
@@ -204,75 +306,600 @@ bool
 ArrayTrim(Array * array)
 {
     void **tmp;
+    size_t newSize;
 
     if (!array)
     {
         return false;
     }
 
-    tmp = array->entries;
-
-    array->entries = Realloc(array->entries,
-                             sizeof(void *) * array->size);
+    /* Keep the entries allocated, even if there aren't any. */
+    newSize = array->size ? array->size : 1;
 
-    if (!array->entries)
+    tmp = Realloc(array->entries, sizeof(void *) * newSize);
+    if (!tmp)
     {
-        array->entries = tmp;
         return false;
     }
 
+    array->entries = tmp;
+    array->allocated = newSize;
+
     return true;
 }
 
+/*
+ * Sorting. ArraySort() is a pattern-defeating quicksort: a quicksort
+ * that picks its pivot from three or nine elements, notices when a
+ * partition is already in order and finishes it with an insertion
+ * sort, breaks up patterns that make for bad partitions, and falls
+ * back on a heapsort when it keeps getting them anyway. Sorted,
+ * reversed and mostly sorted arrays, such as Db listings, are thus
+ * sorted in close to linear time, and no input takes more than
+ * O(n log n) time or O(log n) stack.
+ */
+
+#ifndef ARRAY_SORT_INSERTION
+#define ARRAY_SORT_INSERTION 24
+#endif
+
+#ifndef ARRAY_SORT_NINTHER
+#define ARRAY_SORT_NINTHER 128
+#endif
+
+/* The most elements a partial insertion sort moves before giving up. */
+#define ARRAY_SORT_PARTIAL 8
+
+#ifndef ARRAY_SORT_PARALLEL
+#define ARRAY_SORT_PARALLEL 65536
+#endif
+
+#define ARRAY_SWAP(a, i, j) \
+    do \
+    { \
+        void *swap_ = (a)[i]; \
+        (a)[i] = (a)[j]; \
+        (a)[j] = swap_; \
+    } while (0)
+
+typedef int (*ArrayCompare) (void *, void *);
+
 static void
-ArraySwap(Array * array, size_t i, size_t j)
+ArrayInsertionSort(void **a, size_t n, ArrayCompare compare)
 {
-    void *p = array->entries[i];
+    size_t i;
+    size_t j;
 
-    array->entries[i] = array->entries[j];
-    array->entries[j] = p;
+    for (i = 1; i < n; i++)
+    {
+        void *tmp = a[i];
+
+        for (j = i; j > 0 && compare(tmp, a[j - 1]) < 0; j--)
+        {
+            a[j] = a[j - 1];
+        }
+        a[j] = tmp;
+    }
 }
 
-static size_t
-ArrayPartition(Array * array, size_t low, size_t high, int (*compare) (void *, void *))
+/*
+ * Insertion sort, unless that turns out to move more than a few
+ * elements, in which case this returns false and leaves the rest for
+ * the quicksort.
+ */
+static bool
+ArrayPartialInsertionSort(void **a, size_t n, ArrayCompare compare)
 {
-    void *pivot = array->entries[high];
-    size_t i = low - 1;
+    size_t moved = 0;
+    size_t i;
     size_t j;
 
-    for (j = low; j <= high - 1; j++)
+    for (i = 1; i < n; i++)
     {
-        if (compare(array->entries[j], pivot) < 0)
+        void *tmp = a[i];
+
+        for (j = i; j > 0 && compare(tmp, a[j - 1]) < 0; j--)
+        {
+            a[j] = a[j - 1];
+        }
+        a[j] = tmp;
+
+        moved += i - j;
+        if (moved > ARRAY_SORT_PARTIAL)
         {
-            i++;
-            ArraySwap(array, i, j);
+            return false;
         }
     }
-    ArraySwap(array, i + 1, high);
-    return i + 1;
+
+    return true;
 }
 
 static void
-ArrayQuickSort(Array * array, size_t low, size_t high, int (*compare) (void *, void *))
+ArraySiftDown(void **a, size_t root, size_t n, ArrayCompare compare)
 {
-    if (low < high)
+    void *tmp = a[root];
+    size_t child;
+
+    while ((child = 2 * root + 1) < n)
     {
-        size_t pi = ArrayPartition(array, low, high, compare);
+        if (child + 1 < n && compare(a[child], a[child + 1]) < 0)
+        {
+            child++;
+        }
+        if (compare(tmp, a[child]) >= 0)
+        {
+            break;
+        }
+        a[root] = a[child];
+        root = child;
+    }
+    a[root] = tmp;
+}
+
+static void
+ArrayHeapSort(void **a, size_t n, ArrayCompare compare)
+{
+    size_t i;
 
-        ArrayQuickSort(array, low, pi ? pi - 1 : 0, compare);
-        ArrayQuickSort(array, pi + 1, high, compare);
+    for (i = n / 2; i-- > 0;)
+    {
+        ArraySiftDown(a, i, n, compare);
+    }
+
+    for (i = n; i-- > 1;)
+    {
+        ARRAY_SWAP(a, 0, i);
+        ArraySiftDown(a, 0, i, compare);
     }
 }
 
+static void
+ArraySort2(void **a, size_t i, size_t j, ArrayCompare compare)
+{
+    if (compare(a[j], a[i]) < 0)
+    {
+        ARRAY_SWAP(a, i, j);
+    }
+}
+
+static void
+ArraySort3(void **a, size_t i, size_t j, size_t k, ArrayCompare compare)
+{
+    ArraySort2(a, i, j, compare);
+    ArraySort2(a, j, k, compare);
+    ArraySort2(a, i, j, compare);
+}
+
+/*
+ * Partition around the pivot in a[0], putting the elements less than
+ * it on its left and the rest on its right, and return where it ends
+ * up. The pivot selection guarantees that there is an element at least
+ * as large as the pivot to stop the first scan. If no elements had to
+ * be swapped, the range may well be sorted already, which is reported
+ * through the last argument.
+ */
+static size_t
+ArrayPartitionRight(void **a, size_t n, ArrayCompare compare, bool *swapped)
+{
+    void *pivot = a[0];
+    size_t first = 0;
+    size_t last = n;
+
+    while (compare(a[++first], pivot) < 0);
+
+    if (first == 1)
+    {
+        while (first < last && compare(a[--last], pivot) >= 0);
+    }
+    else
+    {
+        while (compare(a[--last], pivot) >= 0);
+    }
+
+    *swapped = first < last;
+
+    while (first < last)
+    {
+        ARRAY_SWAP(a, first, last);
+        while (compare(a[++first], pivot) < 0);
+        while (compare(a[--last], pivot) >= 0);
+    }
+
+    first--;
+    a[0] = a[first];
+    a[first] = pivot;
+
+    return first;
+}
+
+/*
+ * Partition around the pivot in a[0] with the elements equal to it on
+ * its left. This is used when the pivot equals the element just before
+ * the range, in which case nothing in the range is less than it, and
+ * everything on its left is done.
+ */
+static size_t
+ArrayPartitionLeft(void **a, size_t n, ArrayCompare compare)
+{
+    void *pivot = a[0];
+    size_t first = 0;
+    size_t last = n;
+
+    while (compare(pivot, a[--last]) < 0);
+
+    if (last + 1 == n)
+    {
+        while (first < last && compare(pivot, a[++first]) >= 0);
+    }
+    else
+    {
+        while (compare(pivot, a[++first]) >= 0);
+    }
+
+    while (first < last)
+    {
+        ARRAY_SWAP(a, first, last);
+        while (compare(pivot, a[--last]) < 0);
+        while (compare(pivot, a[++first]) >= 0);
+    }
+
+    a[0] = a[last];
+    a[last] = pivot;
+
+    return last;
+}
+
+/*
+ * Sort n elements. Unless leftmost is set, a[-1] is a previous pivot
+ * which is no greater than anything in the range. Once bad partitions
+ * have been made more than the given number of times, the rest is
+ * heapsorted.
+ */
+static void
+ArrayPdqSort(void **a, size_t n, ArrayCompare compare, unsigned int bad, bool leftmost)
+{
+    while (n >= ARRAY_SORT_INSERTION)
+    {
+        size_t half = n / 2;
+        size_t pivot;
+        size_t l;
+        size_t r;
+        bool swapped;
+
+        if (n > ARRAY_SORT_NINTHER)
+        {
+            ArraySort3(a, 0, half, n - 1, compare);
+            ArraySort3(a, 1, half - 1, n - 2, compare);
+            ArraySort3(a, 2, half + 1, n - 3, compare);
+            ArraySort3(a, half - 1, half, half + 1, compare);
+            ARRAY_SWAP(a, 0, half);
+        }
+        else
+        {
+            ArraySort3(a, half, 0, n - 1, compare);
+        }
+
+        if (!leftmost && compare(a[-1], a[0]) >= 0)
+        {
+            pivot = ArrayPartitionLeft(a, n, compare);
+            a += pivot + 1;
+            n -= pivot + 1;
+            continue;
+        }
+
+        pivot = ArrayPartitionRight(a, n, compare, &swapped);
+        l = pivot;
+        r = n - pivot - 1;
+
+        if (l < n / 8 || r < n / 8)
+        {
+            if (!--bad)
+            {
+                ArrayHeapSort(a, n, compare);
+                return;
+            }
+
+            /* Shuffle a few elements around to break up the pattern. */
+            if (l >= ARRAY_SORT_INSERTION)
+            {
+                ARRAY_SWAP(a, 0, l / 4);
+                ARRAY_SWAP(a, pivot - 1, pivot - l / 4);
+                if (l > ARRAY_SORT_NINTHER)
+                {
+                    ARRAY_SWAP(a, 1, l / 4 + 1);
+                    ARRAY_SWAP(a, 2, l / 4 + 2);
+                    ARRAY_SWAP(a, pivot - 2, pivot - (l / 4 + 1));
+                    ARRAY_SWAP(a, pivot - 3, pivot - (l / 4 + 2));
+                }
+            }
+            if (r >= ARRAY_SORT_INSERTION)
+            {
+                ARRAY_SWAP(a, pivot + 1, pivot + 1 + r / 4);
+                ARRAY_SWAP(a, n - 1, n - r / 4);
+                if (r > ARRAY_SORT_NINTHER)
+                {
+                    ARRAY_SWAP(a, pivot + 2, pivot + 2 + r / 4);
+                    ARRAY_SWAP(a, pivot + 3, pivot + 3 + r / 4);
+                    ARRAY_SWAP(a, n - 2, n - (1 + r / 4));
+                    ARRAY_SWAP(a, n - 3, n - (2 + r / 4));
+                }
+            }
+        }
+        else if (!swapped &&
+                 ArrayPartialInsertionSort(a, l, compare) &&
+                 ArrayPartialInsertionSort(a + pivot + 1, r, compare))
+        {
+            return;
+        }
+
+        /* Recurse into the smaller side and loop on the larger one. */
+        if (l < r)
+        {
+            ArrayPdqSort(a, l, compare, bad, leftmost);
+            a += pivot + 1;
+            n = r;
+            leftmost = false;
+        }
+        else
+        {
+            ArrayPdqSort(a + pivot + 1, r, compare, bad, false);
+            n = l;
+        }
+    }
+
+    ArrayInsertionSort(a, n, compare);
+}
+
 void
 ArraySort(Array * array, int (*compare) (void *, void *))
 {
-    if (!ArraySize(array))
+    unsigned int bad = 1;
+    size_t n;
+
+    if (!ArraySize(array) || !compare)
     {
         // If a NULL ptr was given, or the array has no elements, do nothing.
         return;
     }
-    ArrayQuickSort(array, 0, array->size - 1, compare);
+
+    for (n = array->size; n > 1; n >>= 1)
+    {
+        bad++;
+    }
+
+    ArrayPdqSort(array->entries, array->size, compare, bad, true);
+}
+
+/*
+ * Stable sorting is a merge sort, which needs room for half of the
+ * elements on the side. Runs that are already in order relative to
+ * each other aren't merged at all.
+ */
+static void
+ArrayMerge(void **a, size_t mid, size_t n, void **tmp, ArrayCompare compare)
+{
+    size_t i = 0;
+    size_t j = mid;
+    size_t k = 0;
+
+    if (compare(a[mid - 1], a[mid]) <= 0)
+    {
+        return;
+    }
+
+    memcpy(tmp, a, mid * sizeof(void *));
+
+    while (i < mid && j < n)
+    {
+        /* Take from the left on ties, which keeps the sort stable. */
+        if (compare(a[j], tmp[i]) < 0)
+        {
+            a[k++] = a[j++];
+        }
+        else
+        {
+            a[k++] = tmp[i++];
+        }
+    }
+
+    memcpy(a + k, tmp + i, (mid - i) * sizeof(void *));
+}
+
+static void
+ArrayMergeSort(void **a, size_t n, void **tmp, ArrayCompare compare)
+{
+    size_t mid;
+
+    if (n < ARRAY_SORT_INSERTION)
+    {
+        ArrayInsertionSort(a, n, compare);
+        return;
+    }
+
+    mid = n / 2;
+    ArrayMergeSort(a, mid, tmp, compare);
+    ArrayMergeSort(a + mid, n - mid, tmp, compare);
+    ArrayMerge(a, mid, n, tmp, compare);
+}
+
+bool
+ArraySortStable(Array * array, int (*compare) (void *, void *))
+{
+    void **tmp;
+
+    if (!array || !compare)
+    {
+        return false;
+    }
+
+    if (array->size < ARRAY_SORT_INSERTION)
+    {
+        ArrayInsertionSort(array->entries, array->size, compare);
+        return true;
+    }
+
+    tmp = Malloc((array->size / 2) * sizeof(void *));
+    if (!tmp)
+    {
+        return false;
+    }
+
+    ArrayMergeSort(array->entries, array->size, tmp, compare);
+    Free(tmp);
+
+    return true;
+}
+
+/*
+ * A parallel sort gives each thread a contiguous run of the array to
+ * merge sort, then merges pairs of neighbouring runs, a pass at a
+ * time, with half as many threads in each pass as in the last.
+ */
+typedef struct ArraySortTask
+{
+    pthread_t thread;
+    void **a;
+    void **tmp;
+    size_t mid;                    /* 0 to sort the run, else merge at */
+    size_t n;
+    ArrayCompare compare;
+} ArraySortTask;
+
+static void *
+ArraySortThread(void *args)
+{
+    ArraySortTask *task = args;
+
+    if (task->mid)
+    {
+        ArrayMerge(task->a, task->mid, task->n, task->tmp, task->compare);
+    }
+    else
+    {
+        ArrayMergeSort(task->a, task->n, task->tmp, task->compare);
+    }
+
+    return NULL;
+}
+
+/* Run the given tasks, the first one on the calling thread. */
+static void
+ArraySortRun(ArraySortTask * tasks, size_t count)
+{
+    bool *started = (bool *) (tasks + count);
+    size_t i;
+
+    for (i = 1; i < count; i++)
+    {
+        started[i] = !pthread_create(&tasks[i].thread, NULL,
+                                     ArraySortThread, &tasks[i]);
+    }
+
+    ArraySortThread(&tasks[0]);
+
+    for (i = 1; i < count; i++)
+    {
+        if (started[i])
+        {
+            pthread_join(tasks[i].thread, NULL);
+        }
+        else
+        {
+            ArraySortThread(&tasks[i]);
+        }
+    }
+}
+
+bool
+ArraySortParallel(Array * array, int (*compare) (void *, void *), size_t threads)
+{
+    ArraySortTask *tasks;
+    size_t *bounds;
+    void **tmp;
+    size_t runs;
+    size_t i;
+
+    if (!array || !compare)
+    {
+        return false;
+    }
+
+    if (!threads)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+        threads = (cpus > 0) ? (size_t) cpus : 1;
+    }
+
+    /* Every thread should get a sizable run. */
+    if (threads > array->size / (ARRAY_SORT_PARALLEL / 2))
+    {
+        threads = array->size / (ARRAY_SORT_PARALLEL / 2);
+    }
+
+    if (threads < 2)
+    {
+        return ArraySortStable(array, compare);
+    }
+
+    tmp = Malloc(array->size * sizeof(void *));
+    tasks = Malloc(threads * (sizeof(ArraySortTask) + sizeof(bool)));
+    bounds = Malloc((threads + 1) * sizeof(size_t));
+    if (!tmp || !tasks || !bounds)
+    {
+        Free(tmp);
+        Free(tasks);
+        Free(bounds);
+        return false;
+    }
+
+    for (i = 0; i <= threads; i++)
+    {
+        bounds[i] = array->size / threads * i + (i == threads ? array->size % threads : 0);
+    }
+
+    for (i = 0; i < threads; i++)
+    {
+        tasks[i].a = array->entries + bounds[i];
+        tasks[i].tmp = tmp + bounds[i];
+        tasks[i].mid = 0;
+        tasks[i].n = bounds[i + 1] - bounds[i];
+        tasks[i].compare = compare;
+    }
+    ArraySortRun(tasks, threads);
+
+    for (runs = threads; runs > 1; runs = (runs + 1) / 2)
+    {
+        size_t merges = runs / 2;
+
+        for (i = 0; i < merges; i++)
+        {
+            size_t start = bounds[2 * i];
+
+            tasks[i].a = array->entries + start;
+            tasks[i].tmp = tmp + start;
+            tasks[i].mid = bounds[2 * i + 1] - start;
+            tasks[i].n = bounds[2 * i + 2] - start;
+            tasks[i].compare = compare;
+        }
+        ArraySortRun(tasks, merges);
+
+        /* Drop the bounds between the runs that were just merged. */
+        for (i = 0; i <= runs; i += 2)
+        {
+            bounds[i / 2] = bounds[i];
+        }
+        if (runs % 2)
+        {
+            bounds[runs / 2 + 1] = bounds[runs];
+        }
+    }
+
+    Free(bounds);
+    Free(tasks);
+    Free(tmp);
+
+    return true;
 }
 
 Array *
@@ -281,6 +908,7 @@ ArrayUnique(Array * array, int (*compare) (void *, void *))
     Array *ret;
 
     size_t i;
+    size_t j;
 
     if (!array)
     {
@@ -293,32 +921,36 @@ ArrayUnique(Array * array, int (*compare) (void *, void *))
         return NULL;
     }
 
-    if (ArraySize(ret) == 1)
+    if (ArraySize(ret) < 2)
     {
         /* There can't be any duplicates when there's only 1 value */
         return ret;
     }
 
-    ArraySort(ret, compare);
-
-    for (i = 1; i < ArraySize(ret); i++)
+    /*
+     * Sort stably, so that the first of each set of duplicates is the
+     * one that is kept, then slide the values that are kept down over
+     * the duplicates in one pass.
+     */
+    if (!ArraySortStable(ret, compare))
     {
-        void *cur = ret->entries[i];
-        void *prev = ret->entries[i - 1];
+        ArraySort(ret, compare);
+    }
 
-        if (compare(cur, prev) == 0)
+    for (i = 1, j = 0; i < ret->size; i++)
+    {
+        if (compare(ret->entries[i], ret->entries[j]) != 0)
         {
-            /* Remove the duplicate, and put i back where it was. */
-            ArrayDelete(ret, i--);
+            ret->entries[++j] = ret->entries[i];
         }
     }
+    ret->size = j + 1;
 
     ArrayTrim(ret);
 
     return ret;
 }
 
-
 /* Even though the following operations could be done using only the
  * public Array API defined above, I opted for low-level struct
  * manipulation because it allows much more efficient copying; we only
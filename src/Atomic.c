@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "Atomic.h"
+
+#include <pthread.h>
+
+/*
+ * These are only used when the compiler doesn't provide atomic
+ * builtins. They are always compiled so that the fallback can be
+ * exercised on any compiler by defining ATOMIC_NO_BUILTINS.
+ */
+
+static pthread_mutex_t atomicLock = PTHREAD_MUTEX_INITIALIZER;
+
+size_t
+AtomicSizeLoadLocked(size_t * p)
+{
+    size_t v;
+
+    pthread_mutex_lock(&atomicLock);
+    v = *p;
+    pthread_mutex_unlock(&atomicLock);
+
+    return v;
+}
+
+void
+AtomicSizeStoreLocked(size_t * p, size_t v)
+{
+    pthread_mutex_lock(&atomicLock);
+    *p = v;
+    pthread_mutex_unlock(&atomicLock);
+}
+
+size_t
+AtomicSizeAddLocked(size_t * p, size_t v)
+{
+    size_t r;
+
+    pthread_mutex_lock(&atomicLock);
+    *p += v;
+    r = *p;
+    pthread_mutex_unlock(&atomicLock);
+
+    return r;
+}
+
+size_t
+AtomicSizeOrLocked(size_t * p, size_t v)
+{
+    size_t r;
+
+    pthread_mutex_lock(&atomicLock);
+    *p |= v;
+    r = *p;
+    pthread_mutex_unlock(&atomicLock);
+
+    return r;
+}
+
+size_t
+AtomicSizeFetchAndLocked(size_t * p, size_t v)
+{
+    size_t r;
+
+    pthread_mutex_lock(&atomicLock);
+    r = *p;
+    *p &= v;
+    pthread_mutex_unlock(&atomicLock);
+
+    return r;
+}
+
+bool
+AtomicSizeCasLocked(size_t * p, size_t * expected, size_t desired)
+{
+    bool ret;
+
+    pthread_mutex_lock(&atomicLock);
+    ret = (*p == *expected);
+    if (ret)
+    {
+        *p = desired;
+    }
+    else
+    {
+        *expected = *p;
+    }
+    pthread_mutex_unlock(&atomicLock);
+
+    return ret;
+}
+
+void *
+AtomicPtrLoadLocked(void **p)
+{
+    void *v;
+
+    pthread_mutex_lock(&atomicLock);
+    v = *p;
+    pthread_mutex_unlock(&atomicLock);
+
+    return v;
+}
+
+void
+AtomicPtrStoreLocked(void **p, void *v)
+{
+    pthread_mutex_lock(&atomicLock);
+    *p = v;
+    pthread_mutex_unlock(&atomicLock);
+}
+
+void *
+AtomicPtrExchangeLocked(void **p, void *v)
+{
+    void *old;
+
+    pthread_mutex_lock(&atomicLock);
+    old = *p;
+    *p = v;
+    pthread_mutex_unlock(&atomicLock);
+
+    return old;
+}
+
+bool
+AtomicPtrCasLocked(void **p, void **expected, void *desired)
+{
+    bool ret;
+
+    pthread_mutex_lock(&atomicLock);
+    ret = (*p == *expected);
+    if (ret)
+    {
+        *p = desired;
+    }
+    else
+    {
+        *expected = *p;
+    }
+    pthread_mutex_unlock(&atomicLock);
+
+    return ret;
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef CYTOPLASM_ATOMIC_H
+#define CYTOPLASM_ATOMIC_H
+
+/*
+ * Internal atomic operations. These are not part of the public API;
+ * they exist so that the hot paths of the memory allocator and the
+ * concurrent data structures don't need to take a mutex for simple
+ * counters and pointer swaps.
+ *
+ * When the compiler provides the GCC-style __atomic builtins (GCC and
+ * Clang both do), the operations map directly onto them. Otherwise,
+ * they fall back to functions that serialize on a single global
+ * mutex, which is slow but correct on any POSIX C99 compiler. Because
+ * the fallback can't be type-generic, only size_t and void pointer
+ * variables may be operated on atomically.
+ *
+ * All loads acquire, all stores release, and all read-modify-write
+ * operations are sequentially consistent.
+ */
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#if (defined(__GNUC__) || defined(__clang__)) && !defined(ATOMIC_NO_BUILTINS)
+
+#define AtomicSizeLoad(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define AtomicSizeStore(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define AtomicSizeAdd(p, v) __atomic_add_fetch((p), (v), __ATOMIC_SEQ_CST)
+#define AtomicSizeSub(p, v) __atomic_sub_fetch((p), (v), __ATOMIC_SEQ_CST)
+#define AtomicSizeOr(p, v) __atomic_or_fetch((p), (v), __ATOMIC_SEQ_CST)
+#define AtomicSizeFetchAnd(p, v) __atomic_fetch_and((p), (v), __ATOMIC_SEQ_CST)
+#define AtomicSizeCas(p, e, d) \
+    __atomic_compare_exchange_n((p), (e), (d), 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+
+#define AtomicPtrLoad(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define AtomicPtrStore(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define AtomicPtrExchange(p, v) __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+#define AtomicPtrCas(p, e, d) \
+    __atomic_compare_exchange_n((p), (e), (d), 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+
+#else
+
+#define AtomicSizeLoad(p) AtomicSizeLoadLocked(p)
+#define AtomicSizeStore(p, v) AtomicSizeStoreLocked(p, v)
+#define AtomicSizeAdd(p, v) AtomicSizeAddLocked(p, v)
+#define AtomicSizeSub(p, v) AtomicSizeAddLocked(p, -(size_t) (v))
+#define AtomicSizeOr(p, v) AtomicSizeOrLocked(p, v)
+#define AtomicSizeFetchAnd(p, v) AtomicSizeFetchAndLocked(p, v)
+#define AtomicSizeCas(p, e, d) AtomicSizeCasLocked(p, e, d)
+
+#define AtomicPtrLoad(p) AtomicPtrLoadLocked((void **) (p))
+#define AtomicPtrStore(p, v) AtomicPtrStoreLocked((void **) (p), v)
+#define AtomicPtrExchange(p, v) AtomicPtrExchangeLocked((void **) (p), v)
+#define AtomicPtrCas(p, e, d) AtomicPtrCasLocked((void **) (p), (void **) (e), d)
+
+#endif
+
+extern size_t AtomicSizeLoadLocked(size_t *);
+extern void AtomicSizeStoreLocked(size_t *, size_t);
+extern size_t AtomicSizeAddLocked(size_t *, size_t);
+extern size_t AtomicSizeOrLocked(size_t *, size_t);
+extern size_t AtomicSizeFetchAndLocked(size_t *, size_t);
+extern bool AtomicSizeCasLocked(size_t *, size_t *, size_t);
+
+extern void * AtomicPtrLoadLocked(void **);
+extern void AtomicPtrStoreLocked(void **, void *);
+extern void * AtomicPtrExchangeLocked(void **, void *);
+extern bool AtomicPtrCasLocked(void **, void **, void *);
+
+#endif /* CYTOPLASM_ATOMIC_H */
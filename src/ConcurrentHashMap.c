@@ -0,0 +1,242 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <ConcurrentHashMap.h>
+
+#include <HashMap.h>
+#include <Memory.h>
+
+#include <pthread.h>
+#include <string.h>
+
+/*
+ * Each stripe is an ordinary hash map behind a read-write lock. The
+ * stripes are padded out to whole cache lines, so that threads taking
+ * the locks of neighbouring stripes don't fight over the same line.
+ */
+#define CHM_STRIPE_BITS 5
+#define CHM_STRIPES (1 << CHM_STRIPE_BITS)
+#define CHM_CACHE_LINE 64
+
+typedef struct ConcurrentHashMapStripe
+{
+    pthread_rwlock_t lock;
+    HashMap *map;
+
+    char pad[CHM_CACHE_LINE -
+        (sizeof(pthread_rwlock_t) + sizeof(HashMap *)) % CHM_CACHE_LINE];
+} ConcurrentHashMapStripe;
+
+typedef char ConcurrentHashMapStripeAligned[
+        (sizeof(ConcurrentHashMapStripe) % CHM_CACHE_LINE == 0) ? 1 : -1];
+
+struct ConcurrentHashMap
+{
+    ConcurrentHashMapStripe stripes[CHM_STRIPES];
+};
+
+/*
+ * Pick the stripe of a key. The stripe maps select buckets with the
+ * low bits of the same hash, so the stripe is picked with the high
+ * bits. Otherwise, all the keys in a stripe would share their low
+ * bits, and pile up in the same few buckets.
+ */
+static ConcurrentHashMapStripe *
+ConcurrentHashMapStripeGet(ConcurrentHashMap * map, const char *key)
+{
+    unsigned long hash = HashMapHash(key);
+
+    return &map->stripes[hash >> (sizeof(unsigned long) * 8 - CHM_STRIPE_BITS)];
+}
+
+ConcurrentHashMap *
+ConcurrentHashMapCreate(void)
+{
+    ConcurrentHashMap *map = MallocAligned(sizeof(ConcurrentHashMap), CHM_CACHE_LINE);
+    size_t i;
+
+    if (!map)
+    {
+        return NULL;
+    }
+
+    memset(map, 0, sizeof(ConcurrentHashMap));
+
+    for (i = 0; i < CHM_STRIPES; i++)
+    {
+        ConcurrentHashMapStripe *stripe = &map->stripes[i];
+
+        stripe->map = HashMapCreate();
+        if (!stripe->map || pthread_rwlock_init(&stripe->lock, NULL) != 0)
+        {
+            HashMapFree(stripe->map);
+            while (i--)
+            {
+                pthread_rwlock_destroy(&map->stripes[i].lock);
+                HashMapFree(map->stripes[i].map);
+            }
+            Free(map);
+            return NULL;
+        }
+    }
+
+    return map;
+}
+
+void
+ConcurrentHashMapFree(ConcurrentHashMap * map)
+{
+    size_t i;
+
+    if (!map)
+    {
+        return;
+    }
+
+    for (i = 0; i < CHM_STRIPES; i++)
+    {
+        pthread_rwlock_destroy(&map->stripes[i].lock);
+        HashMapFree(map->stripes[i].map);
+    }
+
+    Free(map);
+}
+
+/*
+ * Set a key while holding the write lock of its stripe, replacing the
+ * value that is already there only if asked to.
+ */
+static void *
+ConcurrentHashMapPut(ConcurrentHashMap * map, char *key, void *value, bool replace)
+{
+    ConcurrentHashMapStripe *stripe;
+    void *old;
+
+    if (!map || !key || !value)
+    {
+        return NULL;
+    }
+
+    stripe = ConcurrentHashMapStripeGet(map, key);
+
+    pthread_rwlock_wrlock(&stripe->lock);
+
+    old = replace ? NULL : HashMapGet(stripe->map, key);
+    if (!old)
+    {
+        old = HashMapSet(stripe->map, key, value);
+    }
+
+    pthread_rwlock_unlock(&stripe->lock);
+
+    return old;
+}
+
+void *
+ConcurrentHashMapSet(ConcurrentHashMap * map, char *key, void *value)
+{
+    return ConcurrentHashMapPut(map, key, value, true);
+}
+
+void *
+ConcurrentHashMapInsert(ConcurrentHashMap * map, char *key, void *value)
+{
+    return ConcurrentHashMapPut(map, key, value, false);
+}
+
+void *
+ConcurrentHashMapGet(ConcurrentHashMap * map, const char *key)
+{
+    ConcurrentHashMapStripe *stripe;
+    void *value;
+
+    if (!map || !key)
+    {
+        return NULL;
+    }
+
+    stripe = ConcurrentHashMapStripeGet(map, key);
+
+    pthread_rwlock_rdlock(&stripe->lock);
+    value = HashMapGet(stripe->map, key);
+    pthread_rwlock_unlock(&stripe->lock);
+
+    return value;
+}
+
+void *
+ConcurrentHashMapDelete(ConcurrentHashMap * map, const char *key)
+{
+    ConcurrentHashMapStripe *stripe;
+    void *value;
+
+    if (!map || !key)
+    {
+        return NULL;
+    }
+
+    stripe = ConcurrentHashMapStripeGet(map, key);
+
+    pthread_rwlock_wrlock(&stripe->lock);
+    value = HashMapDelete(stripe->map, key);
+    pthread_rwlock_unlock(&stripe->lock);
+
+    return value;
+}
+
+void
+ConcurrentHashMapIterate(ConcurrentHashMap * map,
+                         bool (*func) (char *, void *, void *), void *args)
+{
+    size_t i;
+
+    if (!map || !func)
+    {
+        return;
+    }
+
+    for (i = 0; i < CHM_STRIPES; i++)
+    {
+        ConcurrentHashMapStripe *stripe = &map->stripes[i];
+        size_t cursor = 0;
+        bool more = true;
+        char *key;
+        void *value;
+
+        /*
+         * The cursor lives on the stack, so that threads iterating at
+         * the same time don't share the cursor of the stripe map.
+         */
+        pthread_rwlock_rdlock(&stripe->lock);
+        while (more && HashMapIterateReentrant(stripe->map, &key, &value, &cursor))
+        {
+            more = func(key, value, args);
+        }
+        pthread_rwlock_unlock(&stripe->lock);
+
+        if (!more)
+        {
+            return;
+        }
+    }
+}
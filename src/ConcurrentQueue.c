@@ -0,0 +1,357 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <ConcurrentQueue.h>
+
+#include <Memory.h>
+
+#include <pthread.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+
+#include "Atomic.h"
+
+/*
+ * This is a bounded multi-producer, multi-consumer ring. The slot at
+ * position p of the queue is ready to be pushed into when its sequence
+ * number is p, and ready to be popped from when it is p + 1. Whoever
+ * advances the back (or front) of the queue from p owns the slot until
+ * it stores the next sequence number, which hands the slot over to the
+ * other side. A full queue is one where the slot at the back hasn't
+ * been handed back by the pop that took it.
+ *
+ * The front and the back are written by different threads, so they
+ * are kept on cache lines of their own.
+ */
+#define CQ_CACHE_LINE 64
+
+/*
+ * How many times a waiting thread looks at the queue again, yielding
+ * in between, before it goes to sleep. Items usually come in quick
+ * succession, and sleeping costs both sides a system call.
+ */
+#ifndef CQ_SPINS
+#define CQ_SPINS 32
+#endif
+
+typedef struct ConcurrentQueueSlot
+{
+    size_t seq;
+    void *item;
+} ConcurrentQueueSlot;
+
+struct ConcurrentQueue
+{
+    ConcurrentQueueSlot *slots;
+    size_t mask;
+
+    char pad0[CQ_CACHE_LINE - (sizeof(ConcurrentQueueSlot *) + sizeof(size_t))];
+    size_t back;
+    char pad1[CQ_CACHE_LINE - sizeof(size_t)];
+    size_t front;
+    char pad2[CQ_CACHE_LINE - sizeof(size_t)];
+
+    /* Only used to block and wake up waiting threads */
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    size_t waiters;
+    size_t wakeups;
+};
+
+ConcurrentQueue *
+ConcurrentQueueCreate(size_t size)
+{
+    ConcurrentQueue *q;
+    size_t capacity = 2;
+    size_t i;
+
+    if (!size)
+    {
+        /* Can't have a queue of length zero */
+        return NULL;
+    }
+
+    while (capacity < size)
+    {
+        if (capacity > ((size_t) -1) / 2 / sizeof(ConcurrentQueueSlot))
+        {
+            return NULL;
+        }
+        capacity *= 2;
+    }
+
+    q = MallocAligned(sizeof(ConcurrentQueue), CQ_CACHE_LINE);
+    if (!q)
+    {
+        return NULL;
+    }
+
+    q->slots = Malloc(capacity * sizeof(ConcurrentQueueSlot));
+    if (!q->slots)
+    {
+        Free(q);
+        return NULL;
+    }
+
+    if (pthread_mutex_init(&q->lock, NULL) != 0)
+    {
+        Free(q->slots);
+        Free(q);
+        return NULL;
+    }
+
+    if (pthread_cond_init(&q->cond, NULL) != 0)
+    {
+        pthread_mutex_destroy(&q->lock);
+        Free(q->slots);
+        Free(q);
+        return NULL;
+    }
+
+    for (i = 0; i < capacity; i++)
+    {
+        q->slots[i].seq = i;
+        q->slots[i].item = NULL;
+    }
+
+    q->mask = capacity - 1;
+    q->back = 0;
+    q->front = 0;
+    q->waiters = 0;
+    q->wakeups = 0;
+
+    return q;
+}
+
+void
+ConcurrentQueueFree(ConcurrentQueue * q)
+{
+    if (!q)
+    {
+        return;
+    }
+
+    pthread_cond_destroy(&q->cond);
+    pthread_mutex_destroy(&q->lock);
+    Free(q->slots);
+    Free(q);
+}
+
+bool
+ConcurrentQueuePush(ConcurrentQueue * q, void *item)
+{
+    ConcurrentQueueSlot *slot;
+    size_t pos;
+
+    if (!q || !item)
+    {
+        return false;
+    }
+
+    pos = AtomicSizeLoad(&q->back);
+    for (;;)
+    {
+        size_t seq;
+
+        slot = &q->slots[pos & q->mask];
+        seq = AtomicSizeLoad(&slot->seq);
+
+        if (seq == pos)
+        {
+            if (AtomicSizeCas(&q->back, &pos, pos + 1))
+            {
+                break;
+            }
+            /* Another push took the slot; pos now holds the new back. */
+        }
+        else if ((ptrdiff_t) (seq - pos) < 0)
+        {
+            return false;
+        }
+        else
+        {
+            pos = AtomicSizeLoad(&q->back);
+        }
+    }
+
+    slot->item = item;
+    AtomicSizeStore(&slot->seq, pos + 1);
+
+    /*
+     * This has to be a read-modify-write rather than a load, so that
+     * a thread that has just started waiting either is seen here, or
+     * sees the item when it looks at the queue again.
+     */
+    if (AtomicSizeAdd(&q->waiters, 0))
+    {
+        pthread_mutex_lock(&q->lock);
+        pthread_cond_signal(&q->cond);
+        pthread_mutex_unlock(&q->lock);
+    }
+
+    return true;
+}
+
+void *
+ConcurrentQueuePop(ConcurrentQueue * q)
+{
+    ConcurrentQueueSlot *slot;
+    size_t pos;
+    void *item;
+
+    if (!q)
+    {
+        return NULL;
+    }
+
+    pos = AtomicSizeLoad(&q->front);
+    for (;;)
+    {
+        size_t seq;
+
+        slot = &q->slots[pos & q->mask];
+        seq = AtomicSizeLoad(&slot->seq);
+
+        if (seq == pos + 1)
+        {
+            if (AtomicSizeCas(&q->front, &pos, pos + 1))
+            {
+                break;
+            }
+        }
+        else if ((ptrdiff_t) (seq - (pos + 1)) < 0)
+        {
+            return NULL;
+        }
+        else
+        {
+            pos = AtomicSizeLoad(&q->front);
+        }
+    }
+
+    item = slot->item;
+    AtomicSizeStore(&slot->seq, pos + q->mask + 1);
+
+    return item;
+}
+
+void *
+ConcurrentQueueWait(ConcurrentQueue * q, long timeout)
+{
+    struct timespec deadline;
+    size_t wakeups;
+    void *item;
+    int i;
+
+    if (!q)
+    {
+        return NULL;
+    }
+
+    for (i = 0; i < CQ_SPINS; i++)
+    {
+        item = ConcurrentQueuePop(q);
+        if (item || !timeout)
+        {
+            return item;
+        }
+        sched_yield();
+    }
+
+    if (timeout > 0)
+    {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += timeout / 1000;
+        deadline.tv_nsec += (timeout % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000)
+        {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+    }
+
+    pthread_mutex_lock(&q->lock);
+    AtomicSizeAdd(&q->waiters, 1);
+    wakeups = q->wakeups;
+
+    while (!(item = ConcurrentQueuePop(q)) && wakeups == q->wakeups)
+    {
+        if (timeout < 0)
+        {
+            pthread_cond_wait(&q->cond, &q->lock);
+        }
+        else if (pthread_cond_timedwait(&q->cond, &q->lock, &deadline) == ETIMEDOUT)
+        {
+            item = ConcurrentQueuePop(q);
+            break;
+        }
+    }
+
+    AtomicSizeSub(&q->waiters, 1);
+    pthread_mutex_unlock(&q->lock);
+
+    return item;
+}
+
+void
+ConcurrentQueueWake(ConcurrentQueue * q)
+{
+    if (!q)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&q->lock);
+    q->wakeups++;
+    pthread_cond_broadcast(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+}
+
+bool
+ConcurrentQueueFull(ConcurrentQueue * q)
+{
+    size_t pos;
+
+    if (!q)
+    {
+        return false;
+    }
+
+    pos = AtomicSizeLoad(&q->back);
+    return AtomicSizeLoad(&q->slots[pos & q->mask].seq) != pos;
+}
+
+bool
+ConcurrentQueueEmpty(ConcurrentQueue * q)
+{
+    size_t pos;
+
+    if (!q)
+    {
+        return false;
+    }
+
+    pos = AtomicSizeLoad(&q->front);
+    return AtomicSizeLoad(&q->slots[pos & q->mask].seq) != pos + 1;
+}
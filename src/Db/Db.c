@@ -172,13 +172,14 @@ DbHashKey(Array * args)
     return str;
 }
 
+/* Evict the least recently used objects until the cache fits. */
 static void
-DbCacheEvict(Db * db)
+DbCacheEvict(Db * db, size_t limit)
 {
     DbRef *ref = db->leastRecent;
     DbRef *tmp;
 
-    while (ref && db->cacheSize > db->maxCache)
+    while (ref && db->cacheSize > limit)
     {
         char *hash;
 
@@ -231,14 +232,35 @@ DbMaxCacheSet(Db * db, size_t cache)
     if (db->maxCache && !db->cache)
     {
         db->cache = HashMapCreate();
+        MemoryTagSet(db->cache, MEMORY_TAG_DB);
         db->cacheSize = 0;
     }
 
-    DbCacheEvict(db);
+    DbCacheEvict(db, db->maxCache);
 
     pthread_mutex_unlock(&db->lock);
 }
 
+/*
+ * Shed cache when memory gets tight: half of it at the soft limit,
+ * and all of it at the hard limit. The cache grows back to its
+ * normal size on its own once the pressure is gone.
+ */
+static void
+DbPressure(MemoryPressure pressure, void *args)
+{
+    Db *db = args;
+
+    if (pressure == MEMORY_PRESSURE_NONE)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&db->lock);
+    DbCacheEvict(db, pressure == MEMORY_PRESSURE_HARD ? 0 : db->maxCache / 2);
+    pthread_mutex_unlock(&db->lock);
+}
+
 void
 DbClose(Db * db)
 {
@@ -247,13 +269,16 @@ DbClose(Db * db)
         return;
     }
 
+    /* This waits for the callback, so it can't hold the lock. */
+    MemoryPressureUnregister(DbPressure, db);
+
     pthread_mutex_lock(&db->lock);
     if (db->close)
     {
         db->close(db);
     }
     DbMaxCacheSet(db, 0);
-    DbCacheEvict(db);
+    DbCacheEvict(db, db->maxCache);
     HashMapFree(db->cache);
 
     pthread_mutex_unlock(&db->lock);
@@ -525,11 +550,14 @@ DbInit(Db *db)
     if (db->maxCache)
     {
         db->cache = HashMapCreate();
+        MemoryTagSet(db->cache, MEMORY_TAG_DB);
     }
     else
     {
         db->cache = NULL;
     }
+
+    MemoryPressureRegister(DbPressure, db);
 }
 void
 DbRefInit(Db *db, DbRef *ref)
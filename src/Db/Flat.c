@@ -168,7 +168,7 @@ FlatLock(Db *d, DbHint hint, Array *dir)
             goto end;
         }
 
-        ref = Malloc(sizeof(*ref));
+        ref = MallocTagged(sizeof(*ref), MEMORY_TAG_DB);
         DbRefInit(d, (DbRef *) ref);
         /* TODO: Hints */
         ref->base.hint = hint;
@@ -186,6 +186,8 @@ FlatLock(Db *d, DbHint hint, Array *dir)
         
         
         ref->base.name = ArrayCreate();
+        MemoryTagSet(ref->base.name, MEMORY_TAG_DB);
+        ArrayReserve(ref->base.name, ArraySize(dir));
         for (i = 0; i < ArraySize(dir); i++)
         {
             StringArrayAppend(ref->base.name, ArrayGet(dir, i));
@@ -381,7 +383,7 @@ DbOpen(char *dir, size_t cache)
     {
         return NULL;
     }
-    db = Malloc(sizeof(*db));
+    db = MallocTagged(sizeof(*db), MEMORY_TAG_DB);
     DbInit((Db *) db);
     db->dir = dir;
     db->base.cacheSize = cache;
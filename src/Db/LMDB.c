@@ -95,18 +95,16 @@ LMDBKillKey(MDB_val key)
 static HashMap *
 LMDBDecode(MDB_val val)
 {
-    FILE *fakefile;
-    Stream *fakestream;
+    Stream *stream;
     HashMap *ret;
     if (!val.mv_data || !val.mv_size)
     {
         return NULL;
     }
 
-    fakefile = fmemopen(val.mv_data, val.mv_size, "r");
-    fakestream = StreamFile(fakefile);
-    ret = JsonDecode(fakestream);
-    StreamClose(fakestream);
+    stream = StreamFromBuffer(val.mv_data, val.mv_size);
+    ret = JsonDecode(stream);
+    StreamClose(stream);
 
     return ret;
 }
@@ -208,12 +206,14 @@ LMDBLock(Db *d, DbHint hint, Array *k)
         goto end;
     }
 
-    ret = Malloc(sizeof(*ret));
+    ret = MallocTagged(sizeof(*ret), MEMORY_TAG_DB);
     DbRefInit(d, (DbRef *) ret);
     /* TODO: Timestamp */
     {
         size_t i;
         ret->base.name = ArrayCreate();
+        MemoryTagSet(ret->base.name, MEMORY_TAG_DB);
+        ArrayReserve(ret->base.name, ArraySize(k));
         for (i = 0; i < ArraySize(k); i++)
         {
             char *ent = ArrayGet(k, i);
@@ -314,8 +314,9 @@ LMDBUnlock(Db *d, DbRef *r)
 {
     LMDBRef *ref = (LMDBRef *) r;
     LMDB *db = (LMDB *) d;
-    FILE *fakestream;
     Stream *stream;
+    char *json = NULL;
+    size_t jsonLen = 0;
     MDB_val key, val;
     bool ret = true;
     DbHint hint = r ? r->hint : 0;
@@ -331,12 +332,13 @@ LMDBUnlock(Db *d, DbRef *r)
     {
         key = LMDBTranslateKey(r->name);
 
-        fakestream = open_memstream((char **) &val.mv_data, &val.mv_size);
-        stream = StreamFile(fakestream);
+        stream = StreamMemory(&json, &jsonLen);
         JsonEncode(r->json, stream, JSON_DEFAULT);
-        StreamFlush(stream);
         StreamClose(stream);
 
+        val.mv_data = json;
+        val.mv_size = jsonLen;
+
         ret = mdb_put(ref->transaction, db->dbi, &key, &val, 0) == 0;
 
         mdb_txn_commit(ref->transaction);
@@ -346,9 +348,9 @@ LMDBUnlock(Db *d, DbRef *r)
     JsonFree(ref->base.json);
     Free(ref);
 
-    if (val.mv_data)
+    if (json)
     {
-        free(val.mv_data);
+        Free(json);
     }
     if (ret && hint == DB_HINT_WRITE)
     {
@@ -405,12 +407,14 @@ LMDBCreate(Db *d, Array *k)
         goto end;
     }
 
-    ret = Malloc(sizeof(*ret));
+    ret = MallocTagged(sizeof(*ret), MEMORY_TAG_DB);
     DbRefInit(d, (DbRef *) ret);
     /* TODO: Timestamp */
     {
         size_t i;
         ret->base.name = ArrayCreate();
+        MemoryTagSet(ret->base.name, MEMORY_TAG_DB);
+        ArrayReserve(ret->base.name, ArraySize(k));
         for (i = 0; i < ArraySize(k); i++)
         {
             char *ent = ArrayGet(k, i);
@@ -585,7 +589,7 @@ DbOpenLMDB(char *dir, size_t size)
     }
 
 
-    db = Malloc(sizeof(*db));
+    db = MallocTagged(sizeof(*db), MEMORY_TAG_DB);
     DbInit((Db *) db);
     db->environ = env;
     db->dbi = dbi;
@@ -28,29 +28,97 @@
 #include <Array.h>
 
 #include <stddef.h>
+#include <stdint.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
 
-typedef struct HashMapBucket
+/*
+ * The entries of a map are kept densely packed in a single array, in
+ * the order in which their keys were first set, so iterating over a
+ * map is a linear scan. A deleted entry leaves a hole, whose key is
+ * NULL, until the entries are packed again, which happens whenever
+ * the array runs out of room.
+ *
+ * The entries are found through an index: an open addressing table
+ * of slots, whose size is always a power of two, so that a hash is
+ * turned into a slot by masking it. Each slot holds the low bits of
+ * the hash of a key and the position of its entry, so probing the
+ * index touches nothing but the index itself. Collisions are resolved
+ * with Robin Hood hashing: keys are probed for linearly, but a key
+ * that is further from its home slot takes the place of one that is
+ * closer to its own. This keeps probe sequences short and even, lets
+ * a lookup stop as soon as it passes the point where its key would
+ * have been, and allows deletions to shift the following slots back
+ * instead of leaving tombstones behind.
+ *
+ * The stored hash is only a quick filter; keys are always compared in
+ * full, so keys whose hashes collide are still kept apart.
+ *
+ * Most maps, such as the objects of a typical JSON document, only
+ * ever hold a handful of keys. A new map therefore starts out small:
+ * its entries live in the same allocation as the map itself, and are
+ * searched linearly, without an index and without hashing the keys at
+ * all. Only when a map outgrows that array are the keys hashed and
+ * indexed, which the map then keeps doing for the rest of its life.
+ */
+typedef struct HashMapEntry
 {
     unsigned long hash;
     char *key;
     void *value;
-} HashMapBucket;
+} HashMapEntry;
+
+/* An empty slot has no entry; the rest are numbered from 1. */
+typedef struct HashMapSlot
+{
+    uint32_t hash;
+    uint32_t entry;
+} HashMapSlot;
 
 struct HashMap
 {
-    size_t count;
-    size_t capacity;
-    HashMapBucket **entries;
+    size_t count;                  /* Keys in the map */
+    size_t used;                   /* Entries in use, holes included */
+    size_t size;                   /* Entries there is room for */
+    HashMapEntry *entries;
+
+    size_t capacity;               /* Slots in the index */
+    HashMapSlot *slots;
 
     unsigned long (*hashFunc) (const char *);
+    HashMapKeyMode keys;
 
     float maxLoad;
     size_t iterator;
+
+    HashMapEntry local[];
 };
 
-static unsigned long
-HashMapHashKey(const char *key)
+#define HASHMAP_SMALL 8
+#define HASHMAP_MIN_CAPACITY 16
+
+#define HASHMAP_IS_SMALL(map) ((map)->entries == (map)->local)
+
+#define HASHMAP_NONE ((size_t) -1)
+
+/*
+ * How many entries an index of the given capacity takes. At least one
+ * slot is always left empty, so that probing always ends.
+ */
+#define HASHMAP_SIZE(capacity, load) \
+    ((size_t) ((capacity) * (load)) < (capacity) ? \
+     (size_t) ((capacity) * (load)) : (capacity) - 1)
+
+#define HASHMAP_HOME(map, hash) ((size_t) (hash) & ((map)->capacity - 1))
+
+/* How far the slot at the given index is from its home slot. */
+#define HASHMAP_DISTANCE(map, i) \
+    (((i) - HASHMAP_HOME(map, (map)->slots[i].hash)) & ((map)->capacity - 1))
+
+unsigned long
+HashMapHashFnv(const char *key)
 {
     unsigned long hash = 2166136261u;
     size_t i = 0;
@@ -66,75 +134,347 @@ HashMapHashKey(const char *key)
     return hash;
 }
 
-static int
-HashMapGrow(HashMap * map)
+/*
+ * The default hash function follows wyhash, which reads keys eight
+ * bytes at a time, and mixes them with 64 by 128 bit multiplications.
+ * It is seeded once per process with random bytes, so that nobody
+ * outside the process can work out which keys will collide.
+ */
+static const uint64_t hashSecret[4] = {
+    UINT64_C(0xa0761d6478bd642f), UINT64_C(0xe7037ed1a0b428db),
+    UINT64_C(0x8ebc6af09c88c6e3), UINT64_C(0x589965cc75374cc3)
+};
+
+static uint64_t hashSeed;
+static pthread_once_t hashSeedOnce = PTHREAD_ONCE_INIT;
+
+/* Replace a and b with the low and high halves of their product. */
+static void
+HashMapMultiply(uint64_t * a, uint64_t * b)
 {
-    size_t oldCapacity;
-    size_t i;
-    HashMapBucket **newEntries;
+#ifdef __SIZEOF_INT128__
+    __extension__ typedef unsigned __int128 HashMapWide;
+    HashMapWide r = (HashMapWide) * a * *b;
+
+    *a = (uint64_t) r;
+    *b = (uint64_t) (r >> 64);
+#else
+    uint64_t ha = *a >> 32, la = (uint32_t) * a;
+    uint64_t hb = *b >> 32, lb = (uint32_t) * b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32);
+    uint64_t lo = t + (rm1 << 32);
+    uint64_t c = (t < rl) + (lo < t);
+
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
 
-    if (!map)
+/* Multiply, and fold the high half of the product into the low. */
+static uint64_t
+HashMapMix(uint64_t a, uint64_t b)
+{
+    HashMapMultiply(&a, &b);
+    return a ^ b;
+}
+
+static uint64_t
+HashMapRead8(const unsigned char *p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t
+HashMapRead4(const unsigned char *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static void
+HashMapSeedInit(void)
+{
+    uint64_t seed = 0;
+    int fd = open("/dev/urandom", O_RDONLY);
+
+    if (fd < 0 || read(fd, &seed, sizeof(seed)) != sizeof(seed))
     {
-        return 0;
+        /* Not as good, but still differs between processes. */
+        seed = (uint64_t) getpid() ^ (uint64_t) (uintptr_t) &seed;
+    }
+
+    if (fd >= 0)
+    {
+        close(fd);
     }
 
-    oldCapacity = map->capacity;
-    map->capacity *= 2;
+    hashSeed = seed ^ HashMapMix(seed ^ hashSecret[0], hashSecret[1]);
+}
 
-    newEntries = Malloc(map->capacity * sizeof(HashMapBucket *));
-    if (!newEntries)
+unsigned long
+HashMapHash(const char *key)
+{
+    const unsigned char *p = (const unsigned char *) key;
+    size_t len = strlen(key);
+    size_t i = len;
+    uint64_t seed = hashSeed;
+    uint64_t a;
+    uint64_t b;
+
+    if (len <= 16)
     {
-        map->capacity /= 2;
-        return 0;
+        if (len >= 4)
+        {
+            a = (HashMapRead4(p) << 32) | HashMapRead4(p + ((len >> 3) << 2));
+            b = (HashMapRead4(p + len - 4) << 32) |
+                HashMapRead4(p + len - 4 - ((len >> 3) << 2));
+        }
+        else if (len > 0)
+        {
+            a = ((uint64_t) p[0] << 16) | ((uint64_t) p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        }
+        else
+        {
+            a = b = 0;
+        }
     }
+    else
+    {
+        if (i > 48)
+        {
+            uint64_t see1 = seed;
+            uint64_t see2 = seed;
 
-    memset(newEntries, 0, map->capacity * sizeof(HashMapBucket *));
+            do
+            {
+                seed = HashMapMix(HashMapRead8(p) ^ hashSecret[1],
+                                  HashMapRead8(p + 8) ^ seed);
+                see1 = HashMapMix(HashMapRead8(p + 16) ^ hashSecret[2],
+                                  HashMapRead8(p + 24) ^ see1);
+                see2 = HashMapMix(HashMapRead8(p + 32) ^ hashSecret[3],
+                                  HashMapRead8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+
+            seed ^= see1 ^ see2;
+        }
 
-    for (i = 0; i < oldCapacity; i++)
+        while (i > 16)
+        {
+            seed = HashMapMix(HashMapRead8(p) ^ hashSecret[1],
+                              HashMapRead8(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+
+        a = HashMapRead8(p + i - 16);
+        b = HashMapRead8(p + i - 8);
+    }
+
+    a ^= hashSecret[1];
+    b ^= seed;
+    HashMapMultiply(&a, &b);
+
+    return (unsigned long) HashMapMix(a ^ hashSecret[0] ^ len, b ^ hashSecret[1]);
+}
+
+/*
+ * Everything a map allocates is charged to the same memory tag as the
+ * map itself. A map is tagged after HashMapCreate() returns it, but
+ * while it is small, the map is all there is, so everything else is
+ * allocated after the tag is known.
+ */
+static MemoryTag
+HashMapTag(HashMap * map)
+{
+    return MemoryInfoGetTag(MemoryInfoGet(map));
+}
+
+/*
+ * Find the entry that holds the given key, and return its position,
+ * or HASHMAP_NONE if the key isn't there. The slot that points to it
+ * and the hash of the key are stored for the caller, unless the map
+ * is small, in which case it has no slots, and the key isn't hashed
+ * at all.
+ */
+static size_t
+HashMapFind(HashMap * map, const char *key, unsigned long *hashOut, size_t * slotOut)
+{
+    unsigned long hash;
+    size_t i;
+    size_t dist;
+
+    if (HASHMAP_IS_SMALL(map))
     {
-        /* If there is a value here, and it isn't a tombstone */
-        if (map->entries[i] && map->entries[i]->hash)
+        for (i = 0; i < map->used; i++)
         {
-            /* Copy it to the new entries array */
-            size_t index = map->entries[i]->hash % map->capacity;
+            if (StrEquals(map->entries[i].key, key))
+            {
+                return i;
+            }
+        }
+
+        return HASHMAP_NONE;
+    }
+
+    hash = map->hashFunc(key);
+    *hashOut = hash;
+    i = HASHMAP_HOME(map, hash);
+
+    for (dist = 0; dist < map->capacity; dist++)
+    {
+        HashMapSlot *slot = &map->slots[i];
 
-            for (;;)
+        /*
+         * Had the key been here, it would have displaced the key in
+         * this slot, because that one is closer to its home.
+         */
+        if (!slot->entry || HASHMAP_DISTANCE(map, i) < dist)
+        {
+            break;
+        }
+
+        if (slot->hash == (uint32_t) hash &&
+            StrEquals(map->entries[slot->entry - 1].key, key))
+        {
+            if (slotOut)
             {
-                if (newEntries[index])
-                {
-                    if (!newEntries[index]->hash)
-                    {
-                        Free(newEntries[index]);
-                        newEntries[index] = map->entries[i];
-                        break;
-                    }
-                }
-                else
-                {
-                    newEntries[index] = map->entries[i];
-                    break;
-                }
-
-                index = (index + 1) % map->capacity;
+                *slotOut = i;
             }
+            return slot->entry - 1;
         }
-        else
+
+        i = (i + 1) & (map->capacity - 1);
+    }
+
+    return HASHMAP_NONE;
+}
+
+/*
+ * Put a slot that isn't in the index yet into the index. There is
+ * always room for it, because there are more slots than entries.
+ */
+static void
+HashMapPlace(HashMap * map, HashMapSlot slot)
+{
+    size_t i = HASHMAP_HOME(map, slot.hash);
+    size_t dist = 0;
+
+    while (map->slots[i].entry)
+    {
+        size_t other = HASHMAP_DISTANCE(map, i);
+
+        if (other < dist)
+        {
+            HashMapSlot tmp = map->slots[i];
+
+            map->slots[i] = slot;
+            slot = tmp;
+            dist = other;
+        }
+
+        i = (i + 1) & (map->capacity - 1);
+        dist++;
+    }
+
+    map->slots[i] = slot;
+}
+
+/*
+ * Move the entries into a new array with room for at least the given
+ * number of them, packing them as they go, and index them again. The
+ * entries and the index share one allocation. The keys of a small
+ * map are hashed on the way out of it.
+ */
+static int
+HashMapResize(HashMap * map, size_t need)
+{
+    HashMapEntry *entries;
+    size_t capacity = HASHMAP_MIN_CAPACITY;
+    size_t size;
+    size_t i;
+    size_t j;
+    int small;
+
+    while (HASHMAP_SIZE(capacity, map->maxLoad) < need)
+    {
+        if (capacity > UINT32_MAX / 2)
+        {
+            return 0;
+        }
+        capacity *= 2;
+    }
+    size = HASHMAP_SIZE(capacity, map->maxLoad);
+
+    entries = MallocTagged(size * sizeof(HashMapEntry) + capacity * sizeof(HashMapSlot),
+                           HashMapTag(map));
+    if (!entries)
+    {
+        return 0;
+    }
+
+    small = HASHMAP_IS_SMALL(map);
+
+    map->slots = (HashMapSlot *) (entries + size);
+    map->capacity = capacity;
+    memset(map->slots, 0, capacity * sizeof(HashMapSlot));
+
+    for (i = 0, j = 0; i < map->used; i++)
+    {
+        HashMapSlot slot;
+
+        if (!map->entries[i].key)
+        {
+            continue;
+        }
+
+        entries[j] = map->entries[i];
+        if (small)
         {
-            /* Either NULL or a tombstone */
-            Free(map->entries[i]);
+            entries[j].hash = map->hashFunc(entries[j].key);
         }
+
+        slot.hash = (uint32_t) entries[j].hash;
+        slot.entry = j + 1;
+        HashMapPlace(map, slot);
+
+        j++;
+    }
+
+    if (!small)
+    {
+        Free(map->entries);
     }
 
-    Free(map->entries);
-    map->entries = newEntries;
+    map->entries = entries;
+    map->used = j;
+    map->size = size;
+
     return 1;
 }
 
 HashMap *
 HashMapCreate(void)
 {
-    HashMap *map = Malloc(sizeof(HashMap));
+    return HashMapCreateMode(HASHMAP_KEYS_COPY);
+}
+
+HashMap *
+HashMapCreateMode(HashMapKeyMode keys)
+{
+    HashMap *map;
+
+    pthread_once(&hashSeedOnce, HashMapSeedInit);
 
+    map = Malloc(sizeof(HashMap) + HASHMAP_SMALL * sizeof(HashMapEntry));
     if (!map)
     {
         return NULL;
@@ -142,57 +482,113 @@ HashMapCreate(void)
 
     map->maxLoad = 0.75;
     map->count = 0;
-    map->capacity = 16;
+    map->used = 0;
+    map->size = HASHMAP_SMALL;
+    map->entries = map->local;
+    map->capacity = 0;
+    map->slots = NULL;
     map->iterator = 0;
-    map->hashFunc = HashMapHashKey;
+    map->hashFunc = HashMapHash;
+    map->keys = keys;
 
-    map->entries = Malloc(map->capacity * sizeof(HashMapBucket *));
-    if (!map->entries)
+    return map;
+}
+
+bool
+HashMapReserve(HashMap * map, size_t count)
+{
+    if (!map)
     {
-        Free(map);
-        return NULL;
+        return false;
     }
 
-    memset(map->entries, 0, map->capacity * sizeof(HashMapBucket *));
+    /* Deleted entries only make room again once they are packed. */
+    if (count <= map->count || map->used + (count - map->count) <= map->size)
+    {
+        return true;
+    }
 
-    return map;
+    return HashMapResize(map, count);
+}
+
+size_t
+HashMapCount(HashMap * map)
+{
+    return map ? map->count : 0;
 }
 
 void *
 HashMapDelete(HashMap * map, const char *key)
 {
+    size_t e;
+    size_t i;
+    size_t next;
     unsigned long hash;
-    size_t index;
+    void *value;
 
     if (!map || !key)
     {
         return NULL;
     }
 
-    hash = map->hashFunc(key);
-    index = hash % map->capacity;
+    e = HashMapFind(map, key, &hash, &i);
+    if (e == HASHMAP_NONE)
+    {
+        return NULL;
+    }
 
-    for (;;)
+    value = map->entries[e].value;
+    if (map->keys != HASHMAP_KEYS_BORROW)
     {
-        HashMapBucket *bucket = map->entries[index];
+        Free(map->entries[e].key);
+    }
+    map->count--;
 
-        if (!bucket)
-        {
-            break;
-        }
+    if (HASHMAP_IS_SMALL(map))
+    {
+        /* Keep the rest of the entries packed, and in order. */
+        memmove(&map->entries[e], &map->entries[e + 1],
+                (map->used - e - 1) * sizeof(HashMapEntry));
+        map->used--;
 
-        if (bucket->hash == hash)
-        {
-            bucket->hash = 0;
-            Free(bucket->key);
-            bucket->key = NULL;
-            return bucket->value;
-        }
+        return value;
+    }
 
-        index = (index + 1) % map->capacity;
+    map->entries[e].key = NULL;
+    map->entries[e].value = NULL;
+
+    /* Holes at the end can simply be reused. */
+    while (map->used && !map->entries[map->used - 1].key)
+    {
+        map->used--;
     }
 
-    return NULL;
+    /*
+     * Shift the following slots back by one, until one that is empty
+     * or already in its home slot is reached.
+     */
+    next = (i + 1) & (map->capacity - 1);
+    while (map->slots[next].entry && HASHMAP_DISTANCE(map, next))
+    {
+        map->slots[i] = map->slots[next];
+        i = next;
+        next = (i + 1) & (map->capacity - 1);
+    }
+
+    map->slots[i].entry = 0;
+
+    /*
+     * Give back memory after mass deletions, which also packs the
+     * entries, so that iterating doesn't have to skip over the holes.
+     * The map is left with room for twice its keys, so that it doesn't
+     * have to grow again right away.
+     */
+    if (map->capacity > HASHMAP_MIN_CAPACITY && map->count < map->size / 4)
+    {
+        HashMapResize(map, map->count * 2);
+    }
+
+    return value;
 }
 
 void
@@ -202,15 +598,14 @@ HashMapFree(HashMap * map)
     {
         size_t i;
 
-        for (i = 0; i < map->capacity; i++)
+        for (i = 0; map->keys != HASHMAP_KEYS_BORROW && i < map->used; i++)
         {
-            if (map->entries[i])
-            {
-                Free(map->entries[i]->key);
-                Free(map->entries[i]);
-            }
+            Free(map->entries[i].key);
+        }
+        if (!HASHMAP_IS_SMALL(map))
+        {
+            Free(map->entries);
         }
-        Free(map->entries);
         Free(map);
     }
 }
@@ -219,34 +614,20 @@ void *
 HashMapGet(HashMap * map, const char *key)
 {
     unsigned long hash;
-    size_t index;
+    size_t e;
 
     if (!map || !key)
     {
         return NULL;
     }
 
-    hash = map->hashFunc(key);
-    index = hash % map->capacity;
-
-    for (;;)
+    e = HashMapFind(map, key, &hash, NULL);
+    if (e == HASHMAP_NONE)
     {
-        HashMapBucket *bucket = map->entries[index];
-
-        if (!bucket)
-        {
-            break;
-        }
-
-        if (bucket->hash == hash)
-        {
-            return bucket->value;
-        }
-
-        index = (index + 1) % map->capacity;
+        return NULL;
     }
 
-    return NULL;
+    return map->entries[e].value;
 }
 
 bool
@@ -257,29 +638,23 @@ HashMapIterateReentrant(HashMap * map, char **key, void **value, size_t * i)
         return false;
     }
 
-    if (*i >= map->capacity)
+    while (*i < map->used)
     {
-        *i = 0;
-        *key = NULL;
-        *value = NULL;
-        return false;
-    }
-
-    while (*i < map->capacity)
-    {
-        HashMapBucket *bucket = map->entries[*i];
+        HashMapEntry *entry = &map->entries[*i];
 
         *i = *i + 1;
 
-        if (bucket && bucket->hash)
+        if (entry->key)
         {
-            *key = bucket->key;
-            *value = bucket->value;
+            *key = entry->key;
+            *value = entry->value;
             return true;
         }
     }
 
     *i = 0;
+    *key = NULL;
+    *value = NULL;
     return false;
 }
 
@@ -318,72 +693,115 @@ HashMapFunctionSet(HashMap * map, unsigned long (*hashFunc) (const char *))
     map->hashFunc = hashFunc;
 }
 
+void
+HashMapKeyModeSet(HashMap * map, HashMapKeyMode keys)
+{
+    if (!map)
+    {
+        return;
+    }
+
+    /* Borrowed keys can't be mixed with owned ones. */
+    if (map->count &&
+        (keys == HASHMAP_KEYS_BORROW) != (map->keys == HASHMAP_KEYS_BORROW))
+    {
+        return;
+    }
+
+    map->keys = keys;
+}
+
+/*
+ * A map that owns the keys it is given must free them on every path
+ * that doesn't end with them in the map.
+ */
+static void
+HashMapKeyDrop(HashMap * map, char *key)
+{
+    if (map->keys == HASHMAP_KEYS_OWN)
+    {
+        Free(key);
+    }
+}
+
 void *
 HashMapSet(HashMap * map, char *key, void *value)
 {
-    unsigned long hash;
-    size_t index;
+    HashMapEntry entry;
+    HashMapSlot slot;
+    MemoryTag tag;
+    size_t e;
 
-    if (!map || !key || !value)
+    if (!map || !key)
     {
         return NULL;
     }
 
-    key = StrDuplicate(key);
-    if (!key)
+    if (!value)
     {
+        HashMapKeyDrop(map, key);
         return NULL;
     }
 
-    if (map->count + 1 > map->capacity * map->maxLoad)
+    entry.hash = 0;
+
+    e = HashMapFind(map, key, &entry.hash, NULL);
+    if (e != HASHMAP_NONE)
     {
-        HashMapGrow(map);
+        void *oldValue = map->entries[e].value;
+
+        map->entries[e].value = value;
+        HashMapKeyDrop(map, key);
+        return oldValue;
     }
 
-    hash = map->hashFunc(key);
-    index = hash % map->capacity;
+    entry.key = (map->keys == HASHMAP_KEYS_COPY) ? StrDuplicate(key) : key;
+    if (!entry.key)
+    {
+        return NULL;
+    }
+    entry.value = value;
+
+    tag = HashMapTag(map);
+    if (tag && map->keys != HASHMAP_KEYS_BORROW)
+    {
+        MemoryTagSet(entry.key, tag);
+    }
 
-    for (;;)
+    /*
+     * Out of room: pack the entries, and grow if that doesn't leave
+     * enough room to keep going for a while.
+     */
+    if (map->used == map->size)
     {
-        HashMapBucket *bucket = map->entries[index];
+        int small = HASHMAP_IS_SMALL(map);
 
-        if (!bucket)
+        if (!HashMapResize(map, map->count + map->count / 2 + 1))
         {
-            bucket = Malloc(sizeof(HashMapBucket));
-            if (!bucket)
+            if (map->keys == HASHMAP_KEYS_COPY)
             {
-                break;
+                Free(entry.key);
             }
-
-            bucket->hash = hash;
-            bucket->key = key;
-            bucket->value = value;
-            map->entries[index] = bucket;
-            map->count++;
-            break;
+            HashMapKeyDrop(map, entry.key);
+            return NULL;
         }
 
-        if (!bucket->hash)
+        if (small)
         {
-            bucket->hash = hash;
-            Free(bucket->key);
-            bucket->key = key;
-            bucket->value = value;
-            break;
+            entry.hash = map->hashFunc(entry.key);
         }
+    }
 
-        if (bucket->hash == hash)
-        {
-            void *oldValue = bucket->value;
-
-            Free(bucket->key);
-            bucket->key = key;
-
-            bucket->value = value;
-            return oldValue;
-        }
+    e = map->used;
+    map->entries[e] = entry;
+    map->used++;
+    map->count++;
 
-        index = (index + 1) % map->capacity;
+    if (!HASHMAP_IS_SMALL(map))
+    {
+        slot.hash = (uint32_t) entry.hash;
+        slot.entry = e + 1;
+        HashMapPlace(map, slot);
     }
 
     return NULL;
@@ -417,8 +835,9 @@ HashMapKeys(HashMap * map)
     }
 
     arr = ArrayCreate();
-    if (!arr)
+    if (!arr || !ArrayReserve(arr, map->count))
     {
+        ArrayFree(arr);
         return NULL;
     }
 
@@ -444,8 +863,9 @@ HashMapValues(HashMap * map)
     }
 
     arr = ArrayCreate();
-    if (!arr)
+    if (!arr || !ArrayReserve(arr, map->count))
     {
+        ArrayFree(arr);
         return NULL;
     }
 
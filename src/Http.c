@@ -319,28 +319,17 @@ percentEncode:
     return encoded;
 }
 
-char *
-HttpUrlDecode(char *str)
+/*
+ * Decode len bytes of the given percent-encoded string into out,
+ * which must have room for at least len + 1 bytes.
+ */
+static bool
+HttpUrlDecodeSpan(const char *str, size_t len, char *out)
 {
-    size_t i;
-    size_t inputLen;
-    char *decoded;
-
-    if (!str)
-    {
-        return NULL;
-    }
-
-    i = 0;
-    inputLen = strlen(str);
-    decoded = Malloc(inputLen + 1);
+    const char *end = str + len;
+    size_t i = 0;
 
-    if (!decoded)
-    {
-        return NULL;
-    }
-
-    while (*str)
+    while (str < end)
     {
         char c = *str;
 
@@ -353,8 +342,7 @@ HttpUrlDecode(char *str)
             if (sscanf(str, "%2X", &d) != 1)
             {
                 /* Decoding error */
-                Free(decoded);
-                return NULL;
+                return false;
             }
 
             if (!d)
@@ -368,19 +356,94 @@ HttpUrlDecode(char *str)
             str++;
         }
 
-        decoded[i] = c;
+        out[i] = c;
         i++;
 
         str++;
     }
 
-    decoded[i] = '\0';
+    out[i] = '\0';
+
+    return true;
+}
+
+char *
+HttpUrlDecode(char *str)
+{
+    size_t inputLen;
+    char *decoded;
+
+    if (!str)
+    {
+        return NULL;
+    }
+
+    inputLen = strlen(str);
+    decoded = Malloc(inputLen + 1);
+
+    if (!decoded)
+    {
+        return NULL;
+    }
+
+    if (!HttpUrlDecodeSpan(str, inputLen, decoded))
+    {
+        Free(decoded);
+        return NULL;
+    }
 
     return decoded;
 }
 
+/*
+ * Strings that end up in hash maps may come from an arena, in which
+ * case they are released with the arena instead of one at a time, and
+ * the maps only borrow their keys. Otherwise, the maps take over the
+ * keys that are decoded for them.
+ */
+static char *
+HttpStringAllocate(MemoryArena * arena, size_t len)
+{
+    return arena ? MemoryArenaAllocate(arena, len) : Malloc(len);
+}
+
+static HashMap *
+HttpStringMapCreate(MemoryArena * arena)
+{
+    return HashMapCreateMode(arena ? HASHMAP_KEYS_BORROW : HASHMAP_KEYS_OWN);
+}
+
+/*
+ * Maps that own their keys are handed to the caller as ordinary maps,
+ * which copy the keys that are set.
+ */
+static HashMap *
+HttpStringMapDone(HashMap * map, MemoryArena * arena)
+{
+    if (!arena)
+    {
+        HashMapKeyModeSet(map, HASHMAP_KEYS_COPY);
+    }
+
+    return map;
+}
+
+static void
+HttpStringMapFree(HashMap * map, MemoryArena * arena)
+{
+    char *key;
+    void *val;
+
+    while (!arena && HashMapIterate(map, &key, &val))
+    {
+        Free(val);
+    }
+
+    HashMapFree(map);
+}
+
 HashMap *
-HttpParamDecode(char *in)
+HttpParamDecodeArena(char *in, MemoryArena * arena)
 {
     HashMap *params;
 
@@ -389,7 +452,7 @@ HttpParamDecode(char *in)
         return NULL;
     }
 
-    params = HashMapCreate();
+    params = HttpStringMapCreate(arena);
     if (!params)
     {
         return NULL;
@@ -397,93 +460,59 @@ HttpParamDecode(char *in)
 
     while (*in)
     {
-        char *buf;
-        size_t allocated;
         size_t len;
 
         char *decKey;
         char *decVal;
 
-        /* Read in key */
-
-        allocated = CYTOPLASM_STRING_CHUNK;
-        buf = Malloc(allocated);
-        len = 0;
-
-        while (*in && *in != '=')
-        {
-            if (len >= allocated - 1)
-            {
-                allocated += CYTOPLASM_STRING_CHUNK;
-                buf = Realloc(buf, allocated);
-            }
-
-            buf[len] = *in;
-            len++;
-            in++;
-        }
-
-        buf[len] = '\0';
+        /* Read in and decode key */
+        len = strcspn(in, "=");
 
         /* Sanity check */
-        if (*in != '=')
+        if (in[len] != '=')
         {
             /* Malformed param */
-            Free(buf);
-            HashMapFree(params);
+            HttpStringMapFree(params, arena);
             return NULL;
         }
 
-        in++;
-
-        /* Decode key */
-        decKey = HttpUrlDecode(buf);
-        Free(buf);
-
-        if (!decKey)
+        decKey = HttpStringAllocate(arena, len + 1);
+        if (!decKey || !HttpUrlDecodeSpan(in, len, decKey))
         {
-            /* Decoding error */
-            HashMapFree(params);
-            return NULL;
-        }
-
-        /* Read in value */
-        allocated = CYTOPLASM_STRING_CHUNK;
-        buf = Malloc(allocated);
-        len = 0;
-
-        while (*in && *in != '&')
-        {
-            if (len >= allocated - 1)
+            /* Memory or decoding error */
+            if (!arena)
             {
-                allocated += CYTOPLASM_STRING_CHUNK;
-                buf = Realloc(buf, allocated);
+                Free(decKey);
             }
-
-            buf[len] = *in;
-            len++;
-            in++;
+            HttpStringMapFree(params, arena);
+            return NULL;
         }
 
-        buf[len] = '\0';
+        in += len + 1;
 
-        /* Decode value */
-        decVal = HttpUrlDecode(buf);
-        Free(buf);
+        /* Read in and decode value */
+        len = strcspn(in, "&");
 
-        if (!decVal)
+        decVal = HttpStringAllocate(arena, len + 1);
+        if (!decVal || !HttpUrlDecodeSpan(in, len, decVal))
         {
-            /* Decoding error */
-            HashMapFree(params);
+            /* Memory or decoding error */
+            if (!arena)
+            {
+                Free(decKey);
+                Free(decVal);
+            }
+            HttpStringMapFree(params, arena);
             return NULL;
         }
 
-        buf = HashMapSet(params, decKey, decVal);
-        if (buf)
+        in += len;
+
+        decVal = HashMapSet(params, decKey, decVal);
+        if (!arena)
         {
-            Free(buf);
+            Free(decVal);
         }
-        Free(decKey);
 
         if (*in == '&')
         {
@@ -496,7 +525,13 @@ HttpParamDecode(char *in)
         }
     }
 
-    return params;
+    return HttpStringMapDone(params, arena);
+}
+
+HashMap *
+HttpParamDecode(char *in)
+{
+    return HttpParamDecodeArena(in, NULL);
 }
 
 char *
@@ -537,7 +572,7 @@ HttpParamEncode(HashMap * params)
 }
 
 HashMap *
-HttpParseHeaders(Stream * fp)
+HttpParseHeadersArena(Stream * fp, MemoryArena * arena)
 {
     HashMap *headers;
 
@@ -554,7 +589,7 @@ HttpParseHeaders(Stream * fp)
     }
 
 
-    headers = HashMapCreate();
+    headers = HttpStringMapCreate(arena);
     if (!headers)
     {
         return NULL;
@@ -586,15 +621,6 @@ HttpParseHeaders(Stream * fp)
             line[i] = tolower((unsigned char) line[i]);
         }
 
-        len = i + 1;
-        headerKey = Malloc(len * sizeof(char));
-        if (!headerKey)
-        {
-            goto error;
-        }
-
-        strncpy(headerKey, line, len);
-
         headerPtr = line + i + 1;
 
         while (isspace((unsigned char) *headerPtr))
@@ -611,32 +637,51 @@ HttpParseHeaders(Stream * fp)
             line[i] = '\0';
         }
 
+        /*
+         * The key is terminated in place, but the line is reused for
+         * the next header, so the key gets its own copy.
+         */
+        len = strlen(line) + 1;
+        headerKey = HttpStringAllocate(arena, len * sizeof(char));
+        if (!headerKey)
+        {
+            goto error;
+        }
+
+        memcpy(headerKey, line, len);
+
         len = strlen(headerPtr) + 1;
-        headerValue = Malloc(len * sizeof(char));
+        headerValue = HttpStringAllocate(arena, len * sizeof(char));
         if (!headerValue)
         {
-            Free(headerKey);
+            if (!arena)
+            {
+                Free(headerKey);
+            }
             goto error;
         }
 
-        strncpy(headerValue, headerPtr, len);
+        memcpy(headerValue, headerPtr, len);
 
-        Free(HashMapSet(headers, headerKey, headerValue));
-        Free(headerKey);
+        headerValue = HashMapSet(headers, headerKey, headerValue);
+        if (!arena)
+        {
+            Free(headerValue);
+        }
     }
 
     Free(line);
-    return headers;
+    return HttpStringMapDone(headers, arena);
 
 error:
     Free(line);
-
-    while (HashMapIterate(headers, &headerKey, (void **) &headerValue))
-    {
-        Free(headerValue);
-    }
-
-    HashMapFree(headers);
+    HttpStringMapFree(headers, arena);
 
     return NULL;
 }
+
+HashMap *
+HttpParseHeaders(Stream * fp)
+{
+    return HttpParseHeadersArena(fp, NULL);
+}
@@ -23,7 +23,7 @@
  */
 #include <HttpServer.h>
 #include <Memory.h>
-#include <Queue.h>
+#include <ConcurrentQueue.h>
 #include <Array.h>
 #include <Util.h>
 #include <Tls.h>
@@ -46,8 +46,16 @@
 
 #include <errno.h>
 
+#include "Atomic.h"
+
 static const char ENABLE = 1;
 
+static const char BUSY[] =
+"HTTP/1.0 503 Service Unavailable\r\n"
+"Connection: close\r\n"
+"Content-Length: 0\r\n"
+"\r\n";
+
 struct HttpServer
 {
     HttpServerConfig config;
@@ -57,10 +65,13 @@ struct HttpServer
     volatile unsigned int stop:1;
     volatile unsigned int isRunning:1;
 
-    Queue *connQueue;
-    pthread_mutex_t connQueueMutex;
+    /* Accepted connections, waiting for a worker */
+    ConcurrentQueue *connQueue;
 
     Array *threadPool;
+
+    /* The last MemoryPressure level reported */
+    size_t pressure;
 };
 
 struct HttpServerContext
@@ -74,6 +85,7 @@ struct HttpServerContext
     HttpStatus responseStatus;
 
     Stream *stream;
+    MemoryArena *arena;
 };
 
 typedef struct HttpServerWorkerThreadArgs
@@ -84,11 +96,12 @@ typedef struct HttpServerWorkerThreadArgs
 
 static HttpServerContext *
 HttpServerContextCreate(HttpRequestMethod requestMethod,
-          char *requestPath, HashMap * requestParams, Stream * stream)
+          char *requestPath, HashMap * requestParams, Stream * stream,
+                        MemoryArena * arena)
 {
     HttpServerContext *c;
 
-    c = Malloc(sizeof(HttpServerContext));
+    c = MallocTagged(sizeof(HttpServerContext), MEMORY_TAG_HTTP);
     if (!c)
     {
         return NULL;
@@ -101,16 +114,36 @@ HttpServerContextCreate(HttpRequestMethod requestMethod,
         Free(c);
         return NULL;
     }
+    MemoryTagSet(c->responseHeaders, MEMORY_TAG_HTTP);
 
     c->requestMethod = requestMethod;
     c->requestPath = requestPath;
     c->requestParams = requestParams;
     c->stream = stream;
+    c->arena = arena;
     c->responseStatus = HTTP_OK;
 
     return c;
 }
 
+/*
+ * Free a map of request strings. If there is an arena, the strings
+ * live in it and are released along with it.
+ */
+static void
+HttpServerStringsFree(HashMap * map, MemoryArena * arena)
+{
+    char *key;
+    void *val;
+
+    while (!arena && HashMapIterate(map, &key, &val))
+    {
+        Free(val);
+    }
+
+    HashMapFree(map);
+}
+
 static void
 HttpServerContextFree(HttpServerContext * c)
 {
@@ -122,25 +155,32 @@ HttpServerContextFree(HttpServerContext * c)
         return;
     }
 
-    while (HashMapIterate(c->requestHeaders, &key, &val))
+    /*
+     * The request headers, parameters, and path normally live in the
+     * arena, which the worker resets after the request, so only the
+     * maps themselves need to be freed here.
+     */
+    HttpServerStringsFree(c->requestHeaders, c->arena);
+    HttpServerStringsFree(c->requestParams, c->arena);
+    if (!c->arena)
     {
-        Free(val);
+        Free(c->requestPath);
     }
-    HashMapFree(c->requestHeaders);
 
     while (HashMapIterate(c->responseHeaders, &key, &val))
     {
         /*
          * These are generated by code. As such, they may be either
-         * on the heap, or on the stack, depending on how they were
-         * added.
+         * on the heap, in the arena, or on the stack, depending on
+         * how they were added.
          *
          * Basically, if the memory API knows about a pointer, then
          * it can be freed. If it doesn't know about a pointer, skip
-         * freeing it because it's probably a stack pointer.
+         * freeing it because it's probably a stack pointer. The arena
+         * is checked first, because its chunks are on the heap.
          */
 
-        if (MemoryInfoGet(val))
+        if (!MemoryArenaContains(c->arena, val) && MemoryInfoGet(val))
         {
             Free(val);
         }
@@ -148,14 +188,6 @@ HttpServerContextFree(HttpServerContext * c)
 
     HashMapFree(c->responseHeaders);
 
-    while (HashMapIterate(c->requestParams, &key, &val))
-    {
-        Free(val);
-    }
-
-    HashMapFree(c->requestParams);
-
-    Free(c->requestPath);
     StreamClose(c->stream);
 
     Free(c);
@@ -249,39 +281,57 @@ HttpServerStream(HttpServerContext * c)
     return c->stream;
 }
 
+MemoryArena *
+HttpServerArena(HttpServerContext * c)
+{
+    if (!c)
+    {
+        return NULL;
+    }
+
+    return c->arena;
+}
+
 void
 HttpSendHeaders(HttpServerContext * c)
 {
     Stream *fp = c->stream;
+    struct iovec iov[4];
 
     char *key;
     char *val;
 
     StreamPrintf(fp, "HTTP/1.0 %d %s\n", c->responseStatus, HttpStatusToString(c->responseStatus));
 
+    /* Gather the parts of each header rather than formatting them. */
+    iov[1].iov_base = ": ";
+    iov[1].iov_len = 2;
+    iov[3].iov_base = "\n";
+    iov[3].iov_len = 1;
+
     while (HashMapIterate(c->responseHeaders, &key, (void **) &val))
     {
-        StreamPrintf(fp, "%s: %s\n", key, val);
+        iov[0].iov_base = key;
+        iov[0].iov_len = strlen(key);
+        iov[2].iov_base = val;
+        iov[2].iov_len = strlen(val);
+
+        StreamWritev(fp, iov, 4);
     }
 
     StreamPuts(fp, "\n");
 }
 
-static Stream *
-DequeueConnection(HttpServer * server)
+/*
+ * New connections are refused while memory is above the hard limit
+ * of the budget, so that requests already being served can finish.
+ */
+static void
+HttpServerPressure(MemoryPressure pressure, void *args)
 {
-    Stream *fp;
+    HttpServer *server = args;
 
-    if (!server)
-    {
-        return NULL;
-    }
-
-    pthread_mutex_lock(&server->connQueueMutex);
-    fp = QueuePop(server->connQueue);
-    pthread_mutex_unlock(&server->connQueueMutex);
-
-    return fp;
+    AtomicSizeStore(&server->pressure, pressure);
 }
 
 HttpServer *
@@ -311,7 +361,7 @@ HttpServerCreate(HttpServerConfig * config)
     }
 #endif
 
-    server = Malloc(sizeof(HttpServer));
+    server = MallocTagged(sizeof(HttpServer), MEMORY_TAG_HTTP);
     if (!server)
     {
         goto error;
@@ -330,17 +380,12 @@ HttpServerCreate(HttpServerConfig * config)
         goto error;
     }
 
-    server->connQueue = QueueCreate(config->maxConnections);
+    server->connQueue = ConcurrentQueueCreate(config->maxConnections);
     if (!server->connQueue)
     {
         goto error;
     }
 
-    if (pthread_mutex_init(&server->connQueueMutex, NULL) != 0)
-    {
-        goto error;
-    }
-
     server->sd = socket(AF_INET, SOCK_STREAM, 0);
 
     if (server->sd < 0)
@@ -384,17 +429,14 @@ HttpServerCreate(HttpServerConfig * config)
     server->stop = 0;
     server->isRunning = 0;
 
+    MemoryPressureRegister(HttpServerPressure, server);
+
     return server;
 
 error:
     if (server)
     {
-        if (server->connQueue)
-        {
-            QueueFree(server->connQueue);
-        }
-
-        pthread_mutex_destroy(&server->connQueueMutex);
+        ConcurrentQueueFree(server->connQueue);
 
         if (server->threadPool)
         {
@@ -430,9 +472,10 @@ HttpServerFree(HttpServer * server)
         return;
     }
 
+    MemoryPressureUnregister(HttpServerPressure, server);
+
     close(server->sd);
-    QueueFree(server->connQueue);
-    pthread_mutex_destroy(&server->connQueueMutex);
+    ConcurrentQueueFree(server->connQueue);
     ArrayFree(server->threadPool);
     Free(server->config.tlsCert);
     Free(server->config.tlsKey);
@@ -444,6 +487,20 @@ HttpServerWorkerThread(void *args)
 {
     HttpServerWorkerThreadArgs *wArgs = (HttpServerWorkerThreadArgs *) args;
     HttpServer *server = wArgs->server;
+    MemoryArena *arena;
+
+    /*
+     * Everything parsed from a request is allocated from this arena,
+     * which is reset when the request is done so that its first chunk
+     * can be reused by the next one.
+     */
+    arena = MemoryArenaCreate(0);
+    if (!arena)
+    {
+        Log(LOG_WARNING, "HttpServerWorkerThread(): Unable to create a memory arena; "
+            "request data will be allocated on the heap.");
+    }
+    MemoryTagSet(arena, MEMORY_TAG_HTTP);
 
     while (!server->stop)
     {
@@ -467,13 +524,12 @@ HttpServerWorkerThread(void *args)
 
         uint64_t firstRead;
 
-        fp = DequeueConnection(server);
+        /* Sleep until a connection comes in, checking every so
+         * often whether the server was stopped. */
+        fp = ConcurrentQueueWait(server->connQueue, 500);
 
         if (!fp)
         {
-            /* Block for 1 millisecond before continuing so we don't
-             * murder the CPU if the queue is empty. */
-            UtilSleepMillis(1);
             continue;
         }
 
@@ -542,7 +598,13 @@ HttpServerWorkerThread(void *args)
         }
 
         requestPathLen = i;
-        requestPath = Malloc(((requestPathLen + 1) * sizeof(char)));
+        requestPath = arena ?
+                MemoryArenaAllocate(arena, (requestPathLen + 1) * sizeof(char)) :
+                MallocTagged((requestPathLen + 1) * sizeof(char), MEMORY_TAG_HTTP);
+        if (!requestPath)
+        {
+            goto internal_error;
+        }
         strncpy(requestPath, pathPtr, requestPathLen + 1);
 
         requestProtocol = &pathPtr[i + 1];
@@ -550,7 +612,10 @@ HttpServerWorkerThread(void *args)
 
         if (!StrEquals(requestProtocol, "HTTP/1.1") && !StrEquals(requestProtocol, "HTTP/1.0"))
         {
-            Free(requestPath);
+            if (!arena)
+            {
+                Free(requestPath);
+            }
             goto bad_request;
         }
 
@@ -564,16 +629,20 @@ HttpServerWorkerThread(void *args)
         }
 
         requestPath[i] = '\0';
-        requestParams = (i == requestPathLen) ? NULL : HttpParamDecode(requestPath + i + 1);
+        requestParams = (i == requestPathLen) ? NULL : HttpParamDecodeArena(requestPath + i + 1, arena);
 
-        context = HttpServerContextCreate(requestMethod, requestPath, requestParams, fp);
+        context = HttpServerContextCreate(requestMethod, requestPath, requestParams, fp, arena);
         if (!context)
         {
-            Free(requestPath);
+            HttpServerStringsFree(requestParams, arena);
+            if (!arena)
+            {
+                Free(requestPath);
+            }
             goto internal_error;
         }
 
-        context->requestHeaders = HttpParseHeaders(fp);
+        context->requestHeaders = HttpParseHeadersArena(fp, arena);
         if (!context->requestHeaders)
         {
             goto internal_error;
@@ -602,8 +671,11 @@ finish:
         {
             StreamClose(fp);
         }
+
+        MemoryArenaReset(arena);
     }
 
+    MemoryArenaFree(arena);
     return NULL;
 }
 
@@ -623,7 +695,7 @@ HttpServerEventThread(void *args)
 
     for (i = 0; i < server->config.threads; i++)
     {
-        HttpServerWorkerThreadArgs *workerThread = Malloc(sizeof(HttpServerWorkerThreadArgs));
+        HttpServerWorkerThreadArgs *workerThread = MallocTagged(sizeof(HttpServerWorkerThreadArgs), MEMORY_TAG_HTTP);
 
         if (!workerThread)
         {
@@ -659,16 +731,32 @@ HttpServerEventThread(void *args)
             continue;
         }
 
-        pthread_mutex_lock(&server->connQueueMutex);
-
-        /* Don't even accept connections if the queue is full. */
-        if (!QueueFull(server->connQueue))
+        /*
+         * Don't even accept connections if the queue is full. This is
+         * the only thread that pushes onto the queue, so there is
+         * still room for the connection once it is accepted.
+         */
+        if (!ConcurrentQueueFull(server->connQueue))
         {
             connFd = accept(server->sd, (struct sockaddr *) & addr, &addrLen);
 
             if (connFd < 0)
             {
-                pthread_mutex_unlock(&server->connQueueMutex);
+                continue;
+            }
+
+            if (AtomicSizeLoad(&server->pressure) == MEMORY_PRESSURE_HARD)
+            {
+                /*
+                 * Turn the connection away without allocating anything
+                 * for it. TLS clients just see the connection close.
+                 */
+                if (!(server->config.flags & HTTP_FLAG_TLS) &&
+                    write(connFd, BUSY, sizeof(BUSY) - 1) < 0)
+                {
+                    Log(LOG_DEBUG, "Unable to send 503: %s", strerror(errno));
+                }
+                close(connFd);
                 continue;
             }
 
@@ -688,15 +776,20 @@ HttpServerEventThread(void *args)
             if (!fp)
             {
                 close(connFd);
-                pthread_mutex_unlock(&server->connQueueMutex);
                 continue;
             }
 
-            QueuePush(server->connQueue, fp);
+            ConcurrentQueuePush(server->connQueue, fp);
+        }
+        else
+        {
+            /* Give the workers a moment to catch up. */
+            UtilSleepMillis(1);
         }
-        pthread_mutex_unlock(&server->connQueueMutex);
     }
 
+    ConcurrentQueueWake(server->connQueue);
+
     for (i = 0; i < server->config.threads; i++)
     {
         HttpServerWorkerThreadArgs *workerThread = ArrayGet(server->threadPool, i);
@@ -705,7 +798,7 @@ HttpServerEventThread(void *args)
         Free(workerThread);
     }
 
-    while ((fp = DequeueConnection(server)))
+    while ((fp = ConcurrentQueuePop(server->connQueue)))
     {
         StreamClose(fp);
     }
@@ -33,6 +33,7 @@
 struct Io
 {
     IoFunctions io;
+    IoWritevFunc *writev;
     void *cookie;
 };
 
@@ -60,6 +61,7 @@ IoCreate(void *cookie, IoFunctions funcs)
     io->io.write = funcs.write;
     io->io.seek = funcs.seek;
     io->io.close = funcs.close;
+    io->writev = NULL;
 
     return io;
 }
@@ -88,6 +90,57 @@ IoWrite(Io * io, void *buf, size_t nBytes)
     return io->io.write(io->cookie, buf, nBytes);
 }
 
+void
+IoWritevSet(Io * io, IoWritevFunc * func)
+{
+    if (io)
+    {
+        io->writev = func;
+    }
+}
+
+ssize_t
+IoWritev(Io * io, const struct iovec * iov, int iovcnt)
+{
+    ssize_t total = 0;
+    int i;
+
+    if (!io || !io->io.write)
+    {
+        errno = EBADF;
+        return -1;
+    }
+
+    if (io->writev)
+    {
+        return io->writev(io->cookie, iov, iovcnt);
+    }
+
+    for (i = 0; i < iovcnt; i++)
+    {
+        ssize_t writeRes;
+
+        if (!iov[i].iov_len)
+        {
+            continue;
+        }
+
+        writeRes = io->io.write(io->cookie, iov[i].iov_base, iov[i].iov_len);
+        if (writeRes < 0)
+        {
+            return total ? total : -1;
+        }
+
+        total += writeRes;
+        if ((size_t) writeRes < iov[i].iov_len)
+        {
+            break;
+        }
+    }
+
+    return total;
+}
+
 off_t
 IoSeek(Io * io, off_t offset, int whence)
 {
@@ -134,9 +187,9 @@ IoClose(Io * io)
 int
 IoVprintf(Io * io, const char *fmt, va_list ap)
 {
-    char *buf = NULL;
-    size_t bufSize = 0;
-    FILE *fp;
+    char local[IO_BUFFER];
+    char *buf = local;
+    va_list copy;
 
     int ret;
 
@@ -145,22 +198,31 @@ IoVprintf(Io * io, const char *fmt, va_list ap)
         return -1;
     }
 
-    fp = open_memstream(&buf, &bufSize);
-    if (!fp)
+    va_copy(copy, ap);
+    ret = vsnprintf(local, sizeof(local), fmt, copy);
+    va_end(copy);
+
+    if (ret >= (int) sizeof(local))
     {
-        return -1;
-    }
+        buf = Malloc(ret + 1);
+        if (!buf)
+        {
+            return -1;
+        }
 
-    ret = vfprintf(fp, fmt, ap);
-    fclose(fp);
+        vsnprintf(buf, ret + 1, fmt, ap);
+    }
 
     if (ret >= 0)
     {
-        ret = IoWrite(io, buf, bufSize);
+        ret = IoWrite(io, buf, ret);
+    }
+
+    if (buf != local)
+    {
+        Free(buf);
     }
 
-    free(buf);                     /* Allocated by stdlib, not Memory
-                                    * API */
     return ret;
 }
 
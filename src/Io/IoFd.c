@@ -43,6 +43,14 @@ IoWriteFd(void *cookie, void *buf, size_t nBytes)
     return write(fd, buf, nBytes);
 }
 
+static ssize_t
+IoWritevFd(void *cookie, const struct iovec *iov, int iovcnt)
+{
+    int fd = *((int *) cookie);
+
+    return writev(fd, iov, iovcnt);
+}
+
 static off_t
 IoSeekFd(void *cookie, off_t offset, int whence)
 {
@@ -65,6 +73,7 @@ IoFd(int fd)
 {
     int *cookie = Malloc(sizeof(int));
     IoFunctions f;
+    Io *io;
 
     if (!cookie)
     {
@@ -78,7 +87,15 @@ IoFd(int fd)
     f.seek = IoSeekFd;
     f.close = IoCloseFd;
 
-    return IoCreate(cookie, f);
+    io = IoCreate(cookie, f);
+    if (!io)
+    {
+        Free(cookie);
+        return NULL;
+    }
+
+    IoWritevSet(io, IoWritevFd);
+    return io;
 }
 
 Io *
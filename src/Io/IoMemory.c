@@ -0,0 +1,315 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <Io.h>
+
+#include <Memory.h>
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef struct IoMemoryCookie
+{
+    char **buf;
+    size_t *len;
+    size_t size;
+    size_t pos;
+} IoMemoryCookie;
+
+typedef struct IoBufferCookie
+{
+    const uint8_t *buf;
+    size_t len;
+    size_t pos;
+} IoBufferCookie;
+
+/*
+ * Work out where a seek lands in a buffer of the given length, or
+ * return -1 if that is outside of it.
+ */
+static off_t
+IoSeekTarget(size_t pos, size_t len, off_t offset, int whence)
+{
+    off_t base;
+
+    switch (whence)
+    {
+        case SEEK_SET:
+            base = 0;
+            break;
+        case SEEK_CUR:
+            base = pos;
+            break;
+        case SEEK_END:
+            base = len;
+            break;
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+
+    if (offset < -base || offset > (off_t) len - base)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return base + offset;
+}
+
+/*
+ * Make room for the given number of bytes and the terminator after
+ * them, at least doubling the buffer so that growing it is cheap.
+ */
+static bool
+IoMemoryReserve(IoMemoryCookie * mem, size_t need)
+{
+    size_t size;
+    char *buf;
+
+    if (need < mem->size)
+    {
+        return true;
+    }
+
+    size = mem->size * 2;
+    if (size <= need)
+    {
+        size = need + 1;
+    }
+
+    buf = Realloc(*mem->buf, size);
+    if (!buf)
+    {
+        errno = ENOMEM;
+        return false;
+    }
+
+    *mem->buf = buf;
+    mem->size = size;
+    return true;
+}
+
+static ssize_t
+IoReadMemory(void *cookie, void *buf, size_t nBytes)
+{
+    IoMemoryCookie *mem = cookie;
+    size_t left = *mem->len - mem->pos;
+
+    if (nBytes > left)
+    {
+        nBytes = left;
+    }
+
+    if (!nBytes)
+    {
+        return 0;
+    }
+
+    memcpy(buf, *mem->buf + mem->pos, nBytes);
+    mem->pos += nBytes;
+
+    return nBytes;
+}
+
+static ssize_t
+IoWriteMemory(void *cookie, void *buf, size_t nBytes)
+{
+    IoMemoryCookie *mem = cookie;
+
+    if (nBytes > SIZE_MAX - 1 - mem->pos)
+    {
+        errno = EFBIG;
+        return -1;
+    }
+
+    if (!IoMemoryReserve(mem, mem->pos + nBytes))
+    {
+        return -1;
+    }
+
+    memcpy(*mem->buf + mem->pos, buf, nBytes);
+    mem->pos += nBytes;
+
+    if (mem->pos > *mem->len)
+    {
+        *mem->len = mem->pos;
+        (*mem->buf)[mem->pos] = '\0';
+    }
+
+    return nBytes;
+}
+
+static off_t
+IoSeekMemory(void *cookie, off_t offset, int whence)
+{
+    IoMemoryCookie *mem = cookie;
+    off_t pos = IoSeekTarget(mem->pos, *mem->len, offset, whence);
+
+    if (pos >= 0)
+    {
+        mem->pos = pos;
+    }
+
+    return pos;
+}
+
+static int
+IoCloseMemory(void *cookie)
+{
+    /* The buffer belongs to the caller now */
+    Free(cookie);
+    return 0;
+}
+
+Io *
+IoMemory(char **buf, size_t * len)
+{
+    IoMemoryCookie *mem;
+    IoFunctions f;
+    Io *io;
+
+    if (!buf || !len)
+    {
+        return NULL;
+    }
+
+    mem = Malloc(sizeof(IoMemoryCookie));
+    if (!mem)
+    {
+        return NULL;
+    }
+
+    mem->buf = buf;
+    mem->len = len;
+    mem->size = 0;
+    mem->pos = 0;
+
+    *buf = NULL;
+    *len = 0;
+
+    if (!IoMemoryReserve(mem, 0))
+    {
+        Free(mem);
+        return NULL;
+    }
+    **buf = '\0';
+
+    f.read = IoReadMemory;
+    f.write = IoWriteMemory;
+    f.seek = IoSeekMemory;
+    f.close = IoCloseMemory;
+
+    io = IoCreate(mem, f);
+    if (!io)
+    {
+        Free(*buf);
+        *buf = NULL;
+        Free(mem);
+        return NULL;
+    }
+
+    return io;
+}
+
+static ssize_t
+IoReadBuffer(void *cookie, void *buf, size_t nBytes)
+{
+    IoBufferCookie *view = cookie;
+    size_t left = view->len - view->pos;
+
+    if (nBytes > left)
+    {
+        nBytes = left;
+    }
+
+    if (!nBytes)
+    {
+        return 0;
+    }
+
+    memcpy(buf, view->buf + view->pos, nBytes);
+    view->pos += nBytes;
+
+    return nBytes;
+}
+
+static off_t
+IoSeekBuffer(void *cookie, off_t offset, int whence)
+{
+    IoBufferCookie *view = cookie;
+    off_t pos = IoSeekTarget(view->pos, view->len, offset, whence);
+
+    if (pos >= 0)
+    {
+        view->pos = pos;
+    }
+
+    return pos;
+}
+
+static int
+IoCloseBuffer(void *cookie)
+{
+    Free(cookie);
+    return 0;
+}
+
+Io *
+IoFromBuffer(const void *buf, size_t len)
+{
+    IoBufferCookie *view;
+    IoFunctions f;
+    Io *io;
+
+    if (!buf && len)
+    {
+        return NULL;
+    }
+
+    view = Malloc(sizeof(IoBufferCookie));
+    if (!view)
+    {
+        return NULL;
+    }
+
+    view->buf = buf;
+    view->len = len;
+    view->pos = 0;
+
+    f.read = IoReadBuffer;
+    f.write = NULL;
+    f.seek = IoSeekBuffer;
+    f.close = IoCloseBuffer;
+
+    io = IoCreate(view, f);
+    if (!io)
+    {
+        Free(view);
+        return NULL;
+    }
+
+    return io;
+}
@@ -91,7 +91,7 @@ JsonValueType(JsonValue * value)
 static JsonValue *
 JsonValueAllocate(void)
 {
-    return Malloc(sizeof(JsonValue));
+    return MallocTagged(sizeof(JsonValue), MEMORY_TAG_JSON);
 }
 
 JsonValue *
@@ -112,6 +112,7 @@ JsonValueObject(HashMap * object)
 
     value->type = JSON_OBJECT;
     value->as.object = object;
+    MemoryTagSet(object, MEMORY_TAG_JSON);
 
     return value;
 }
@@ -146,6 +147,7 @@ JsonValueArray(Array * array)
 
     value->type = JSON_ARRAY;
     value->as.array = array;
+    MemoryTagSet(array, MEMORY_TAG_JSON);
 
     return value;
 }
@@ -186,6 +188,7 @@ JsonValueString(char *string)
         Free(value);
         return NULL;
     }
+    MemoryTagSet(value->as.string, MEMORY_TAG_JSON);
 
     return value;
 }
@@ -349,6 +352,17 @@ JsonEncodeString(const char *str, Stream * out)
     i = 0;
     while ((c = str[i]) != '\0')
     {
+        /* Write out runs of characters that need no escaping at once. */
+        size_t run = strcspn(str + i, "\\\"/\b\t\n\f\r");
+
+        if (run)
+        {
+            StreamWrite(out, str + i, run);
+            length += run;
+            i += run;
+            continue;
+        }
+
         switch (c)
         {
             case '\\':
@@ -413,14 +427,57 @@ JsonDecodeString(Stream * in)
     len = 0;
     allocated = strBlockSize;
 
-    str = Malloc(allocated * sizeof(char));
+    str = MallocTagged(allocated * sizeof(char), MEMORY_TAG_JSON);
     if (!str)
     {
         return NULL;
     }
 
-    while ((c = StreamGetc(in)) != EOF)
+    while (1)
     {
+        const char *span;
+        size_t avail = StreamPeek(in, &span);
+        size_t run = 0;
+
+        /*
+         * Copy the plain characters in the buffer over in one go, and
+         * only go through them one at a time once an escape, a control
+         * character or the closing quote comes up.
+         */
+        while (run < avail && (unsigned char) span[run] > 0x1F &&
+               span[run] != '"' && span[run] != '\\')
+        {
+            run++;
+        }
+
+        if (run)
+        {
+            if (len + run > allocated)
+            {
+                char *tmp;
+
+                allocated = (len + run > allocated * 2) ? len + run : allocated * 2;
+                tmp = Realloc(str, allocated * sizeof(char));
+                if (!tmp)
+                {
+                    Free(str);
+                    return NULL;
+                }
+
+                str = tmp;
+            }
+
+            memcpy(str + len, span, run);
+            len += run;
+            StreamConsume(in, run);
+            continue;
+        }
+
+        if ((c = StreamGetc(in)) == EOF)
+        {
+            break;
+        }
+
         if (c <= 0x001F)
         {
             /* Bad byte; these must be escaped */
@@ -685,11 +742,7 @@ JsonEncode(HashMap * object, Stream * out, int level)
         return -1;
     }
 
-    count = 0;
-    while (HashMapIterate(object, &key, (void **) &value))
-    {
-        count++;
-    }
+    count = HashMapCount(object);
 
     /* The total number of bytes written */
     length = 0;
@@ -795,6 +848,8 @@ JsonValueDuplicate(JsonValue * val)
             break;
         case JSON_ARRAY:
             new->as.array = ArrayCreate();
+            MemoryTagSet(new->as.array, MEMORY_TAG_JSON);
+            ArrayReserve(new->as.array, ArraySize(val->as.array));
             for (i = 0; i < ArraySize(val->as.array); i++)
             {
                 ArrayAdd(new->as.array, JsonValueDuplicate(ArrayGet(val->as.array, i)));
@@ -802,6 +857,7 @@ JsonValueDuplicate(JsonValue * val)
             break;
         case JSON_STRING:
             new->as.string = StrDuplicate(val->as.string);
+            MemoryTagSet(new->as.string, MEMORY_TAG_JSON);
             break;
         case JSON_INTEGER:
         case JSON_FLOAT:
@@ -833,6 +889,8 @@ JsonDuplicate(HashMap * object)
     {
         return NULL;
     }
+    MemoryTagSet(new, MEMORY_TAG_JSON);
+    HashMapReserve(new, HashMapCount(object));
 
     while (HashMapIterate(object, &key, (void **) &val))
     {
@@ -954,7 +1012,7 @@ JsonTokenSeek(JsonParserState * state)
                 size_t allocated = 16;
 
                 state->tokenLen = 1;
-                state->token = Malloc(allocated);
+                state->token = MallocTagged(allocated, MEMORY_TAG_JSON);
                 if (!state->token)
                 {
                     state->tokenType = TOKEN_EOF;
@@ -1021,7 +1079,7 @@ JsonTokenSeek(JsonParserState * state)
             else
             {
                 state->tokenLen = 8;
-                state->token = Malloc(state->tokenLen);
+                state->token = MallocTagged(state->tokenLen, MEMORY_TAG_JSON);
                 if (!state->token)
                 {
                     state->tokenType = TOKEN_EOF;
@@ -1135,7 +1193,7 @@ JsonDecodeValue(JsonParserState * state)
             value = JsonValueArray(JsonDecodeArray(state));
             break;
         case TOKEN_STRING:
-            strValue = Malloc(state->tokenLen + 1);
+            strValue = MallocTagged(state->tokenLen + 1, MEMORY_TAG_JSON);
             if (!strValue)
             {
                 return NULL;
@@ -1192,20 +1250,25 @@ JsonDecodeValue(JsonParserState * state)
 static HashMap *
 JsonDecodeObject(JsonParserState * state)
 {
-    HashMap *obj = HashMapCreate();
+    /*
+     * Keys are decoded into their own buffers, so the object can take
+     * them over instead of copying each one.
+     */
+    HashMap *obj = HashMapCreateMode(HASHMAP_KEYS_OWN);
     int comma = 0;
 
     if (!obj)
     {
         return NULL;
     }
+    MemoryTagSet(obj, MEMORY_TAG_JSON);
 
     do
     {
         JsonTokenSeek(state);
         if (JsonExpect(state, TOKEN_STRING))
         {
-            char *key = Malloc(state->tokenLen + 1);
+            char *key = MallocTagged(state->tokenLen + 1, MEMORY_TAG_JSON);
             JsonValue *value;
 
             if (!key)
@@ -1230,9 +1293,11 @@ JsonDecodeObject(JsonParserState * state)
                 goto error;
             }
 
-            /* If there's an existing value at this key, discard it. */
+            /*
+             * If there's an existing value at this key, discard it.
+             * The object owns the key from here on.
+             */
             JsonValueFree(HashMapSet(obj, key, value));
-            Free(key);
 
             JsonTokenSeek(state);
 
@@ -1259,6 +1324,8 @@ JsonDecodeObject(JsonParserState * state)
         }
     } while (!JsonExpect(state, TOKEN_EOF));
 
+    /* Callers expect to be able to set keys they keep. */
+    HashMapKeyModeSet(obj, HASHMAP_KEYS_COPY);
     return obj;
 error:
     JsonFree(obj);
@@ -1276,6 +1343,7 @@ JsonDecodeArray(JsonParserState * state)
     {
         return NULL;
     }
+    MemoryTagSet(arr, MEMORY_TAG_JSON);
 
     do
     {
@@ -53,7 +53,7 @@ LogConfigCreate(void)
 {
     LogConfig *config;
 
-    config = Malloc(sizeof(LogConfig));
+    config = MallocTagged(sizeof(LogConfig), MEMORY_TAG_LOG);
 
     if (!config)
     {
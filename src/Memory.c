@@ -32,52 +32,193 @@
 #include <unistd.h>
 #include <pthread.h>
 
-#ifndef MEMORY_TABLE_CHUNK
-#define MEMORY_TABLE_CHUNK 256
-#endif
+#include "Atomic.h"
+#include "Memory/Internal.h"
 
 #ifndef MEMORY_HEXDUMP_WIDTH
 #define MEMORY_HEXDUMP_WIDTH 16
 #endif
 
-#define MEMORY_FILE_SIZE 256
+/*
+ * The hook and its arguments are published together, so that a thread
+ * never runs a new hook with old arguments. Allocations read the hook
+ * without taking any lock, so a replaced hook may still be running
+ * somewhere; it is kept around until the runtime is destroyed.
+ */
+typedef struct MemoryHookRecord
+{
+    void (*func) (MemoryAction, MemoryInfo *, void *);
+    void *args;
+    struct MemoryHookRecord *next;
+} MemoryHookRecord;
+
+static MemoryHookRecord defaultHook = {MemoryDefaultHook, NULL, NULL};
+static void *hook = &defaultHook;
+
+void
+MemoryHookRun(MemoryAction action, MemoryInfo * a)
+{
+    MemoryHookRecord *rec = AtomicPtrLoad(&hook);
+
+    if (rec->func)
+    {
+        rec->func(action, a, rec->args);
+    }
+}
+
+void
+MemoryHookDestroy(void)
+{
+    MemoryHookRecord *rec = AtomicPtrExchange(&hook, &defaultHook);
+
+    while (rec && rec != &defaultHook)
+    {
+        MemoryHookRecord *next = rec->next;
+
+        free(rec);
+        rec = next;
+    }
+}
+
+void *
+MemoryLineAllocate(size_t size)
+{
+    void *p;
+
+    /* Round up, so that the end of the last line isn't shared either. */
+    size = (size + MEM_CACHE_LINE - 1) / MEM_CACHE_LINE * MEM_CACHE_LINE;
+    if (posix_memalign(&p, MEM_CACHE_LINE, size) != 0)
+    {
+        return NULL;
+    }
+
+    return p;
+}
+
+void
+ MemoryHook(void (*memHook) (MemoryAction, MemoryInfo *, void *), void *args)
+{
+    MemoryHookRecord *rec = malloc(sizeof(MemoryHookRecord));
+
+    if (!rec)
+    {
+        return;
+    }
+
+    rec->func = memHook;
+    rec->args = args;
+    rec->next = AtomicPtrExchange(&hook, rec);
+}
+
+#if MEMORY_TRACKING == MEMORY_TRACKING_FULL
+
+#ifndef MEMORY_SITES
+#define MEMORY_SITES 4096
+#endif
+
+#ifndef MEMORY_SHARDS
+#define MEMORY_SHARDS 64
+#endif
+
+#if MEMORY_SITES > 65536
+#error "MEMORY_SITES must fit in 16 bits."
+#endif
+
+#if MEMORY_SHARDS > 256
+#error "MEMORY_SHARDS must fit in 8 bits."
+#endif
 
 #define MEM_BOUND_TYPE uint64_t
 #define MEM_BOUND 0xDEADBEEFBEEFDEAD
-#define MEM_MAGIC 0xDEADBEEFDEADBEEF
+#define MEM_MAGIC 0xDEADBEEF
+#define MEM_BAD_MAGIC 0xBAADF00D
+#define MEM_REMOTE_MAGIC 0xFEEDFACE
+
+/*
+ * Every allocation is prefixed with this header, so it is kept as
+ * small as possible. The file name and line number are not stored
+ * in the header; instead, they are interned into a table of call
+ * sites, and the header only stores an index into that table. The
+ * magic number is the last field so that it sits directly in front
+ * of the user data and doubles as the left boundary.
+ *
+ * The header must be a multiple of MEM_ALIGN bytes, so that the data
+ * behind it is aligned as well as malloc() would align it. That is
+ * 32 bytes with 64 bit pointers; with 32 bit pointers the fields only
+ * take 20, so the header is padded out.
+ */
+#define MEM_ALIGN 16
 
 struct MemoryInfo
 {
-    uint64_t magic;
+    MemoryInfo *prev;
+    MemoryInfo *next;
 
     size_t size;
-    size_t unalignedSize;
-    char file[MEMORY_FILE_SIZE];
+#if SIZE_MAX <= UINT32_MAX
+    uint8_t pad[12];
+#endif
+    uint16_t site;
+    uint8_t shard;
+    uint8_t flags;
+    uint32_t magic;
+};
+
+typedef char MemoryInfoAligned[(sizeof(MemoryInfo) % MEM_ALIGN == 0) ? 1 : -1];
+
+/*
+ * A call site is a unique file and line number pair. The file name
+ * is always a pointer to a static __FILE__ string, so it never
+ * needs to be copied.
+ */
+typedef struct MemorySite
+{
+    const char *file;
     int line;
-    void *pointer;
+} MemorySite;
 
-    MemoryInfo *prev;
-    MemoryInfo *next;
+/*
+ * Live allocations are tracked in a number of shards, each with its
+ * own list and lock. Each thread is assigned a shard the first time
+ * it allocates, so threads don't contend with each other when they
+ * allocate and free their own memory. Shards are padded out to whole
+ * cache lines and allocated on a line boundary, so that neighbouring
+ * shards don't share one either.
+ *
+ * When a thread frees a block owned by a shard that is busy, it
+ * doesn't wait for the lock. The block is instead pushed onto the
+ * shard's remote list, which is a lock-free stack threaded through
+ * the first word of each block's (now dead) data. Whoever takes the
+ * shard lock next unlinks and releases those blocks.
+ */
+typedef struct MemoryShard
+{
+    pthread_mutex_t lock;
+    MemoryInfo *tail;
 
-    MEM_BOUND_TYPE leftBoundary;
-};
+    void *remote;
 
-#define MEM_SIZE_ACTUAL(x) (MemoryAlignBoundary((x) * sizeof(uint8_t)) + sizeof(MEM_BOUND_TYPE))
-#define MEM_START_BOUNDARY(info) (info->leftBoundary)
-#define MEM_END_BOUNDARY(info) (*(((MEM_BOUND_TYPE *) (((uint8_t *) info->pointer) + info->size)) - 1))
+    uint8_t pad[MEM_CACHE_LINE -
+        (sizeof(pthread_mutex_t) + 2 * sizeof(void *)) % MEM_CACHE_LINE];
+} MemoryShard;
 
+typedef char MemoryShardAligned[(sizeof(MemoryShard) % MEM_CACHE_LINE == 0) ? 1 : -1];
 
-static pthread_mutex_t lock;
-static void (*hook) (MemoryAction, MemoryInfo *, void *) = MemoryDefaultHook;
-static void *hookArgs = NULL;
+#define MEM_SIZE_ACTUAL(x) (MemoryAlignBoundary((x) * sizeof(uint8_t)) + sizeof(MEM_BOUND_TYPE))
+#define MEM_POINTER(info) ((void *) ((info) + 1))
+#define MEM_END_BOUNDARY(info) (*(((MEM_BOUND_TYPE *) (((uint8_t *) MEM_POINTER(info)) + MEM_SIZE_ACTUAL((info)->size))) - 1))
+#define MEM_REMOTE_NEXT(info) (*((MemoryInfo **) MEM_POINTER(info)))
+#define MEM_BLOCK_SIZE(x) (sizeof(MemoryInfo) + MEM_SIZE_ACTUAL(x))
 
-static size_t allocationsLen = 0;
+/* Protects insertions into the call site table. */
+static pthread_mutex_t lock;
 
-static MemoryInfo *allocationTail = NULL;
+static MemoryShard *shards;
+static pthread_key_t shardKey;
+static size_t shardNext = 0;
 
-/* Simple range of "plausible" boundaries for heap, serving as an extra 
- * check */
-static void *heapStart, *heapEnd;
+/* Slot 0 is reserved for call sites that don't fit in the table. */
+static MemorySite sites[MEMORY_SITES] = {{"(unknown)", 0}};
 
 static size_t MemoryAlignBoundary(size_t size)
 {
@@ -88,10 +229,78 @@ static size_t MemoryAlignBoundary(size_t size)
     return closest * boundSize;
 }
 
+/*
+ * Find the index of the given call site in the site table, adding it
+ * if it isn't there yet. Sites are hashed by the address of the file
+ * name string, because __FILE__ is always a static string. Lookups
+ * don't lock; a slot's file pointer is only published after its line
+ * number is written, so a non-NULL file always has a valid line.
+ */
+static uint16_t
+MemorySiteGet(const char *file, int line)
+{
+    unsigned long hash = ((unsigned long) file >> 3) * 31 + (unsigned long) line;
+    size_t index = 1 + (hash % (MEMORY_SITES - 1));
+    size_t probes;
+    uint16_t ret = 0;
+
+    for (probes = 1; probes < MEMORY_SITES; probes++)
+    {
+        MemorySite *site = &sites[index];
+        const char *siteFile = AtomicPtrLoad(&site->file);
+
+        if (!siteFile)
+        {
+            pthread_mutex_lock(&lock);
+            siteFile = site->file;
+            if (!siteFile)
+            {
+                site->line = line;
+                AtomicPtrStore(&site->file, (void *) file);
+                pthread_mutex_unlock(&lock);
+                return index;
+            }
+            pthread_mutex_unlock(&lock);
+
+            /* Somebody else claimed this slot first; check it again. */
+            probes--;
+            continue;
+        }
+
+        if (site->line == line && siteFile == file)
+        {
+            return index;
+        }
+
+        index = (index % (MEMORY_SITES - 1)) + 1;
+    }
+
+    /* Table is full */
+    return ret;
+}
+
+static uint16_t
+MemoryShardSelf(void)
+{
+    void *p = pthread_getspecific(shardKey);
+    size_t index;
+
+    if (p)
+    {
+        return (uint16_t) ((uintptr_t) p - 1);
+    }
+
+    index = (AtomicSizeAdd(&shardNext, 1) - 1) % MEMORY_SHARDS;
+    pthread_setspecific(shardKey, (void *) (uintptr_t) (index + 1));
+
+    return index;
+}
+
 int
 MemoryRuntimeInit(void)
 {
     pthread_mutexattr_t attr;
+    size_t i;
     int ret = 0;
 
     if (pthread_mutexattr_init(&attr) != 0)
@@ -99,11 +308,39 @@ MemoryRuntimeInit(void)
         goto finish;
     }
 
+    shards = MemoryLineAllocate(MEMORY_SHARDS * sizeof(MemoryShard));
+    if (!shards)
+    {
+        pthread_mutexattr_destroy(&attr);
+        goto finish;
+    }
+
     pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
     ret = pthread_mutex_init(&lock, &attr);
+    for (i = 0; i < MEMORY_SHARDS && ret == 0; i++)
+    {
+        shards[i].tail = NULL;
+        shards[i].remote = NULL;
+        ret = pthread_mutex_init(&shards[i].lock, &attr);
+    }
     pthread_mutexattr_destroy(&attr);
-    heapStart = NULL;
-    heapEnd = NULL;
+
+    if (ret == 0)
+    {
+        ret = pthread_key_create(&shardKey, NULL);
+    }
+
+    if (ret == 0 && (!MemoryProfileInit() || !MemoryBudgetInit()))
+    {
+        ret = -1;
+    }
+
+#ifdef MEMORY_SLAB
+    if (ret == 0 && !MemorySlabInit())
+    {
+        ret = -1;
+    }
+#endif
 
     ret = (ret == 0);
 
@@ -114,38 +351,51 @@ finish:
 int
 MemoryRuntimeDestroy(void)
 {
+    size_t i;
+    int ret = 1;
+
     MemoryFreeAll();
-    return pthread_mutex_destroy(&lock) == 0;
+    MemoryIndexDestroy();
+
+    for (i = 0; i < MEMORY_SHARDS; i++)
+    {
+        ret &= pthread_mutex_destroy(&shards[i].lock) == 0;
+    }
+    free(shards);
+    shards = NULL;
+
+    pthread_key_delete(shardKey);
+
+    MemoryHookDestroy();
+    MemoryProfileDestroy();
+    MemoryBudgetDestroy();
+
+#ifdef MEMORY_SLAB
+    MemorySlabDestroy();
+#endif
+
+    return ret && pthread_mutex_destroy(&lock) == 0;
 }
 
-static int
-MemoryInsert(MemoryInfo * a)
+/* The caller must hold the shard lock. */
+static void
+MemoryInsert(MemoryShard * shard, MemoryInfo * a)
 {
-    if (allocationTail)
+    if (shard->tail)
     {
-        allocationTail->next = a;
+        shard->tail->next = a;
     }
     a->next = NULL;
-    a->prev = allocationTail;
+    a->prev = shard->tail;
+    a->shard = shard - shards;
     a->magic = MEM_MAGIC;
 
-    if (!heapStart || heapStart > (void *) a)
-    {
-        heapStart = a;
-    }
-    if (!heapEnd || heapEnd < (void *) a)
-    {
-        heapEnd = a;
-    }
-
-    allocationTail = a;
-    allocationsLen++;
-
-    return 1;
+    shard->tail = a;
 }
 
+/* The caller must hold the shard lock. */
 static void
-MemoryDelete(MemoryInfo * a)
+MemoryDelete(MemoryShard * shard, MemoryInfo * a)
 {
     MemoryInfo *aPrev = a->prev;
     MemoryInfo *aNext = a->next;
@@ -159,82 +409,211 @@ MemoryDelete(MemoryInfo * a)
         aNext->prev = aPrev;
     }
 
-    if (a == allocationTail)
+    if (a == shard->tail)
     {
-        allocationTail = aPrev;
+        shard->tail = aPrev;
     }
 
     a->magic = ~MEM_MAGIC;
 }
 
+/*
+ * Hand a block back to the backend. Aligned blocks are somewhere in
+ * the middle of the raw block they were carved from.
+ */
+static void
+MemoryRelease(MemoryInfo * a)
+{
+    if (a->flags & MEM_FLAG_ALIGNED)
+    {
+        MemoryAlignedPrefix *prefix = MEM_ALIGNED_PREFIX(a);
+
+        MEM_BACKEND_FREE(prefix->base,
+            MEM_BLOCK_SIZE(a->size) + MEM_ALIGNED_EXTRA(prefix->align));
+        return;
+    }
+
+    MEM_BACKEND_FREE(a, MEM_BLOCK_SIZE(a->size));
+}
+
+/*
+ * Release all the blocks that other threads have freed into this
+ * shard. The caller must hold the shard lock.
+ */
+static void
+MemoryReclaim(MemoryShard * shard)
+{
+    MemoryInfo *a;
+
+    if (!AtomicPtrLoad(&shard->remote))
+    {
+        return;
+    }
+
+    a = AtomicPtrExchange(&shard->remote, NULL);
+    while (a)
+    {
+        MemoryInfo *next = MEM_REMOTE_NEXT(a);
+
+        MemoryDelete(shard, a);
+        MemoryRelease(a);
+
+        a = next;
+    }
+}
+
 static int
 MemoryCheck(MemoryInfo * a)
 {
-    if (MEM_START_BOUNDARY(a) != MEM_BOUND || 
-        a->magic != MEM_MAGIC ||
-        MEM_END_BOUNDARY(a) != MEM_BOUND)
+    if (a->magic != MEM_MAGIC || MEM_END_BOUNDARY(a) != MEM_BOUND)
     {
-        if (hook)
-        {
-            hook(MEMORY_CORRUPTED, a, hookArgs);
-        }
+        MemoryHookRun(MEMORY_CORRUPTED, a);
         return 0;
     }
     return 1;
 }
 
-void *
-MemoryAllocate(size_t size, const char *file, int line)
+/*
+ * Report a pointer that the memory API doesn't know about. The hook
+ * expects a memory info structure, so a temporary one is built on
+ * the stack.
+ */
+static void
+MemoryBadPointer(void *p, const char *file, int line)
 {
-    void *p;
-    MemoryInfo *a;
+    struct
+    {
+        MemoryInfo info;
+        void *pointer;
+    } bad;
+    MemoryHookRecord *rec = AtomicPtrLoad(&hook);
 
-    //MemoryIterate(NULL, NULL);
+    if (!rec->func)
+    {
+        return;
+    }
 
     pthread_mutex_lock(&lock);
+    bad.info.prev = NULL;
+    bad.info.next = NULL;
+    bad.info.size = 0;
+    bad.info.site = MemorySiteGet(file, line);
+    bad.info.shard = 0;
+    bad.info.flags = 0;
+    bad.info.magic = MEM_BAD_MAGIC;
+    bad.pointer = p;
+    rec->func(MEMORY_BAD_POINTER, &bad.info, rec->args);
+    pthread_mutex_unlock(&lock);
+}
 
-    a = malloc(sizeof(MemoryInfo) + MEM_SIZE_ACTUAL(size));
-    if (!a)
+/*
+ * Allocate a block with the given alignment, or with the natural
+ * alignment of the backend if it is 0.
+ */
+static void *
+MemoryAllocateBlock(size_t size, size_t align, MemoryTag tag,
+                    const char *file, int line)
+{
+    MemoryShard *shard;
+    MemoryInfo *a;
+    void *raw;
+    void *p;
+
+    raw = MEM_BACKEND_ALLOCATE(MEM_BLOCK_SIZE(size) +
+                               (align ? MEM_ALIGNED_EXTRA(align) : 0));
+    if (!raw)
     {
-        pthread_mutex_unlock(&lock);
         return NULL;
     }
 
-    p = a + 1;
+    if (align)
+    {
+        p = (void *) MEM_ALIGN_UP((uint8_t *) raw +
+            sizeof(MemoryAlignedPrefix) + sizeof(MemoryInfo), align);
+        a = ((MemoryInfo *) p) - 1;
+        a->flags = MEM_FLAG_WITH_TAG(MEM_FLAG_ALIGNED, tag);
+
+        MEM_ALIGNED_PREFIX(a)->base = raw;
+        MEM_ALIGNED_PREFIX(a)->align = align;
+    }
+    else
+    {
+        a = raw;
+        p = MEM_POINTER(a);
+        a->flags = MEM_FLAG_WITH_TAG(0, tag);
+    }
 
     memset(p, 0, MEM_SIZE_ACTUAL(size));
 
-    a->size = MEM_SIZE_ACTUAL(size);
-    a->unalignedSize = size;
-    strncpy(a->file, file, MEMORY_FILE_SIZE - 1);
-    a->line = line;
-    a->pointer = p;
-    MEM_START_BOUNDARY(a) = MEM_BOUND;
+    a->size = size;
+    a->site = MemorySiteGet(file, line);
     MEM_END_BOUNDARY(a) = MEM_BOUND;
 
-    if (!MemoryInsert(a))
+    if (!MemoryIndexAdd(p))
     {
-        free(a);
-        pthread_mutex_unlock(&lock);
+        MEM_BACKEND_FREE(raw, MEM_BLOCK_SIZE(size) +
+                         (align ? MEM_ALIGNED_EXTRA(align) : 0));
         return NULL;
     }
 
-    if (hook)
+    if (tag)
     {
-        hook(MEMORY_ALLOCATE, a, hookArgs);
+        MemoryTagAllocate(tag, size);
     }
 
-    pthread_mutex_unlock(&lock);
+    if (MemoryBudgetAllocate(size))
+    {
+        a->flags |= MEM_FLAG_BUDGET;
+    }
+
+    if (MemoryProfileSample(size) && MemoryProfileAllocate(p, size, file, line))
+    {
+        a->flags |= MEM_FLAG_SAMPLED;
+    }
+
+    shard = &shards[MemoryShardSelf()];
+
+    pthread_mutex_lock(&shard->lock);
+    MemoryReclaim(shard);
+    MemoryInsert(shard, a);
+    pthread_mutex_unlock(&shard->lock);
+
+    MemoryHookRun(MEMORY_ALLOCATE, a);
+
     return p;
 }
 
+void *
+MemoryAllocateTagged(size_t size, MemoryTag tag, const char *file, int line)
+{
+    return MemoryAllocateBlock(size, 0, tag, file, line);
+}
+
+void *
+MemoryAllocateAligned(size_t size, size_t align, const char *file, int line)
+{
+    if (!align || (align & (align - 1)))
+    {
+        return NULL;
+    }
+
+    return MemoryAllocateBlock(size, align > MEM_NATURAL_ALIGN ? align : 0,
+                               MEMORY_TAG_NONE, file, line);
+}
+
+void *
+MemoryAllocate(size_t size, const char *file, int line)
+{
+    return MemoryAllocateTagged(size, MEMORY_TAG_NONE, file, line);
+}
+
 void *
 MemoryReallocate(void *p, size_t size, const char *file, int line)
 {
+    MemoryShard *shard;
     MemoryInfo *a;
     void *new = NULL;
-
-    //MemoryIterate(NULL, NULL);
+    size_t old;
 
     if (!p)
     {
@@ -242,108 +621,221 @@ MemoryReallocate(void *p, size_t size, const char *file, int line)
     }
 
     a = MemoryInfoGet(p);
-    if (a)
+    if (!a)
     {
-        pthread_mutex_lock(&lock);
-        MemoryDelete(a);
-        new = realloc(a, sizeof(MemoryInfo) + MEM_SIZE_ACTUAL(size));
+        MemoryBadPointer(p, file, line);
+        return NULL;
+    }
+
+    /*
+     * The backend can't keep an aligned block aligned when it moves,
+     * so it is copied into a new one instead.
+     */
+    if (a->flags & MEM_FLAG_ALIGNED)
+    {
+        new = MemoryAllocateBlock(size, MEM_ALIGNED_PREFIX(a)->align,
+                                  MEM_FLAG_TAG(a->flags), file, line);
         if (new)
         {
-            a = new;
-            a->unalignedSize = size;
-            a->size = MEM_SIZE_ACTUAL(size);
-            strncpy(a->file, file, MEMORY_FILE_SIZE - 1);
-            a->line = line;
-            a->magic = MEM_MAGIC;
+            memcpy(new, p, a->size < size ? a->size : size);
+            MemoryFree(p, file, line);
+        }
+        return new;
+    }
 
-            a->pointer = a + 1;
-            MemoryInsert(a);
+    /*
+     * The block may move, so take it out of its owning shard, and put
+     * it in the shard of the calling thread afterwards.
+     */
+    shard = &shards[a->shard];
+    pthread_mutex_lock(&shard->lock);
+    MemoryDelete(shard, a);
+    pthread_mutex_unlock(&shard->lock);
+
+    /*
+     * The profiler forgets the old block before it can be reused, and
+     * the new one is treated like a fresh allocation.
+     */
+    if (a->flags & MEM_FLAG_SAMPLED)
+    {
+        MemoryProfileFree(p, a->size);
+        a->flags &= ~MEM_FLAG_SAMPLED;
+    }
 
-            MEM_START_BOUNDARY(a) = MEM_BOUND;
-            MEM_END_BOUNDARY(a) = MEM_BOUND;
+    /*
+     * Once the backend has the block, its old address may be handed
+     * out again by another thread, so it must leave the index first.
+     */
+    MemoryIndexTake(p);
 
-            if (hook)
-            {
-                hook(MEMORY_REALLOCATE, a, hookArgs);
-            }
-            
+    old = a->size;
+    new = MEM_BACKEND_REALLOCATE(a, MEM_BLOCK_SIZE(old), MEM_BLOCK_SIZE(size));
+    if (new && !MemoryIndexAdd(MEM_POINTER((MemoryInfo *) new)))
+    {
+        /*
+         * The block moved to a part of the address space that the
+         * index has no room for. This can only happen when memory is
+         * exhausted, and the contents can't be moved back, so the
+         * block is lost rather than handed out untracked.
+         */
+        a = new;
+        if (MEM_FLAG_TAG(a->flags))
+        {
+            MemoryTagFree(MEM_FLAG_TAG(a->flags), old);
         }
-        pthread_mutex_unlock(&lock);
+        if (a->flags & MEM_FLAG_BUDGET)
+        {
+            MemoryBudgetFree(old);
+        }
+
+        MEM_BACKEND_FREE(a, MEM_BLOCK_SIZE(size));
+        return NULL;
     }
-    else if (hook)
+
+    if (new)
     {
-        a = malloc(sizeof(MemoryInfo));
-        if (a)
+        a = new;
+        a->size = size;
+        if (MEM_FLAG_TAG(a->flags))
         {
-            a->size = 0;
-            strncpy(a->file, file, MEMORY_FILE_SIZE - 1);
-            a->line = line;
-            a->pointer = p;
-            hook(MEMORY_BAD_POINTER, a, hookArgs);
-            free(a);
+            MemoryTagFree(MEM_FLAG_TAG(a->flags), old);
+            MemoryTagAllocate(MEM_FLAG_TAG(a->flags), size);
+        }
+
+        if (a->flags & MEM_FLAG_BUDGET)
+        {
+            MemoryBudgetFree(old);
+            a->flags &= ~MEM_FLAG_BUDGET;
+        }
+        if (MemoryBudgetAllocate(size))
+        {
+            a->flags |= MEM_FLAG_BUDGET;
+        }
+        a->site = MemorySiteGet(file, line);
+        MEM_END_BOUNDARY(a) = MEM_BOUND;
+
+        new = MEM_POINTER(a);
+        if (MemoryProfileSample(size) && MemoryProfileAllocate(new, size, file, line))
+        {
+            a->flags |= MEM_FLAG_SAMPLED;
         }
     }
 
-    return a->pointer;
+    /* If realloc() failed, the old block is still valid. */
+    if (!new)
+    {
+        MemoryIndexAdd(p);
+    }
+
+    shard = &shards[MemoryShardSelf()];
+    pthread_mutex_lock(&shard->lock);
+    MemoryInsert(shard, a);
+    pthread_mutex_unlock(&shard->lock);
+
+    if (new)
+    {
+        MemoryHookRun(MEMORY_REALLOCATE, a);
+    }
+
+    return new;
 }
 
 void
 MemoryFree(void *p, const char *file, int line)
 {
+    MemoryHookRecord *rec;
+    MemoryShard *shard;
     MemoryInfo *a;
-
-    //MemoryIterate(NULL, NULL);
+    void *head;
 
     if (!p)
     {
         return;
     }
 
-    a = MemoryInfoGet(p);
-    if (a)
+    /*
+     * Taking the block out of the index is what validates the pointer,
+     * so that a block freed twice at once is only released once.
+     */
+    a = ((MemoryInfo *) p) - 1;
+    if (!MemoryIndexTake(p) || a->magic != MEM_MAGIC)
     {
-        pthread_mutex_lock(&lock);
-        if (hook)
-        {
-            strncpy(a->file, file, MEMORY_FILE_SIZE - 1);
-            a->line = line;
-            hook(MEMORY_FREE, a, hookArgs);
-        }
-        MemoryDelete(a);
-        free(a);
+        MemoryBadPointer(p, file, line);
+        return;
+    }
 
-        pthread_mutex_unlock(&lock);
+    rec = AtomicPtrLoad(&hook);
+    if (rec->func)
+    {
+        a->site = MemorySiteGet(file, line);
+        rec->func(MEMORY_FREE, a, rec->args);
     }
-    else if (hook)
+
+    if (a->flags & MEM_FLAG_SAMPLED)
+    {
+        MemoryProfileFree(p, a->size);
+    }
+
+    if (MEM_FLAG_TAG(a->flags))
+    {
+        MemoryTagFree(MEM_FLAG_TAG(a->flags), a->size);
+    }
+
+    if (a->flags & MEM_FLAG_BUDGET)
+    {
+        MemoryBudgetFree(a->size);
+    }
+
+    shard = &shards[a->shard];
+
+    if (a->shard == MemoryShardSelf())
     {
-        a = malloc(sizeof(MemoryInfo));
-        if (a)
+        pthread_mutex_lock(&shard->lock);
+    }
+    else if (pthread_mutex_trylock(&shard->lock) != 0)
+    {
+        /* The owning shard is busy; hand the block off to it. */
+        a->magic = MEM_REMOTE_MAGIC;
+        head = AtomicPtrLoad(&shard->remote);
+        do
         {
-            strncpy(a->file, file, MEMORY_FILE_SIZE - 1);
-            a->line = line;
-            a->size = 0;
-            a->pointer = p;
-            hook(MEMORY_BAD_POINTER, a, hookArgs);
-            free(a);
-        }
+            MEM_REMOTE_NEXT(a) = head;
+        } while (!AtomicPtrCas(&shard->remote, &head, (void *) a));
+
+        return;
     }
+
+    MemoryReclaim(shard);
+    MemoryDelete(shard, a);
+    pthread_mutex_unlock(&shard->lock);
+
+    MemoryRelease(a);
 }
 
 size_t
 MemoryAllocated(void)
 {
     size_t total = 0;
+    size_t i;
     MemoryInfo *cur;
 
-    pthread_mutex_lock(&lock);
-
-    /* TODO */
-    for (cur = allocationTail; cur; cur = cur->prev)
+    for (i = 0; i < MEMORY_SHARDS; i++)
     {
-        total += MemoryInfoGetSize(cur);
-    }
+        MemoryShard *shard = &shards[i];
 
-    pthread_mutex_unlock(&lock);
+        pthread_mutex_lock(&shard->lock);
+        MemoryReclaim(shard);
+
+        for (cur = shard->tail; cur; cur = cur->prev)
+        {
+            if (cur->magic != MEM_REMOTE_MAGIC)
+            {
+                total += MemoryInfoGetSize(cur);
+            }
+        }
+
+        pthread_mutex_unlock(&shard->lock);
+    }
 
     return total;
 }
@@ -353,42 +845,51 @@ MemoryFreeAll(void)
 {
     MemoryInfo *cur;
     MemoryInfo *prev;
+    size_t i;
 
-    pthread_mutex_lock(&lock);
-
-    /* TODO */
-    for (cur = allocationTail; cur; cur = prev)
+    for (i = 0; i < MEMORY_SHARDS; i++)
     {
-        prev = cur->prev;
-        free(cur);
-    }
+        MemoryShard *shard = &shards[i];
 
-    allocationsLen = 0;
+        pthread_mutex_lock(&shard->lock);
+        MemoryReclaim(shard);
 
-    pthread_mutex_unlock(&lock);
+        for (cur = shard->tail; cur; cur = prev)
+        {
+            prev = cur->prev;
+            MemoryIndexTake(MEM_POINTER(cur));
+            MemoryRelease(cur);
+        }
+
+        shard->tail = NULL;
+
+        pthread_mutex_unlock(&shard->lock);
+    }
 }
 
 MemoryInfo *
-MemoryInfoGet(void *po)
+MemoryInfoGet(void *p)
 {
-    void *p = po;
+    MemoryInfo *a;
 
-    pthread_mutex_lock(&lock);
+    if (!p)
+    {
+        return NULL;
+    }
 
-    p = ((MemoryInfo *) p) - 1;
-    if (p < heapStart || p > heapEnd)
+    /* The header of a pointer that isn't indexed may not even exist. */
+    if (!MemoryIndexHas(p))
     {
-        pthread_mutex_unlock(&lock);
         return NULL;
     }
 
-    if (((MemoryInfo *)p)->magic != MEM_MAGIC)
+    a = ((MemoryInfo *) p) - 1;
+    if (a->magic != MEM_MAGIC)
     {
-        p = NULL;
+        return NULL;
     }
 
-    pthread_mutex_unlock(&lock);
-    return p;
+    return a;
 }
 
 size_t
@@ -399,7 +900,7 @@ MemoryInfoGetSize(MemoryInfo * a)
         return 0;
     }
 
-    return a->size ? a->unalignedSize : 0;
+    return a->size;
 }
 
 const char *
@@ -410,7 +911,7 @@ MemoryInfoGetFile(MemoryInfo * a)
         return NULL;
     }
 
-    return a->file;
+    return sites[a->site].file;
 }
 
 int
@@ -421,7 +922,33 @@ MemoryInfoGetLine(MemoryInfo * a)
         return -1;
     }
 
-    return a->line;
+    return sites[a->site].line;
+}
+
+MemoryTag
+MemoryInfoGetTag(MemoryInfo * a)
+{
+    if (!a)
+    {
+        return MEMORY_TAG_NONE;
+    }
+
+    return MEM_FLAG_TAG(a->flags);
+}
+
+void
+MemoryTagSet(void *p, MemoryTag tag)
+{
+    MemoryInfo *a = MemoryInfoGet(p);
+
+    if (!a || (unsigned int) tag >= MEMORY_TAG_COUNT ||
+        MEM_FLAG_TAG(a->flags) == (unsigned int) tag)
+    {
+        return;
+    }
+
+    MemoryTagMove(MEM_FLAG_TAG(a->flags), tag, a->size);
+    a->flags = MEM_FLAG_WITH_TAG(a->flags, tag);
 }
 
 void *
@@ -432,36 +959,48 @@ MemoryInfoGetPointer(MemoryInfo * a)
         return NULL;
     }
 
-    return a->pointer;
+    if (a->magic == MEM_BAD_MAGIC)
+    {
+        /* Temporary info from MemoryBadPointer() */
+        return *((void **) MEM_POINTER(a));
+    }
+
+    return MEM_POINTER(a);
 }
 
 void
 MemoryIterate(void (*iterFunc) (MemoryInfo *, void *), void *args)
 {
     MemoryInfo *cur;
+    size_t i;
 
-    pthread_mutex_lock(&lock);
-
-    for (cur = allocationTail; cur; cur = cur->prev)
+    for (i = 0; i < MEMORY_SHARDS; i++)
     {
-        MemoryCheck(cur);
-        if (iterFunc)
+        MemoryShard *shard = &shards[i];
+
+        pthread_mutex_lock(&shard->lock);
+        MemoryReclaim(shard);
+
+        for (cur = shard->tail; cur; cur = cur->prev)
         {
-            iterFunc(cur, args);
+            if (cur->magic == MEM_REMOTE_MAGIC)
+            {
+                /* Freed by another thread while we hold the lock */
+                continue;
+            }
+
+            MemoryCheck(cur);
+            if (iterFunc)
+            {
+                iterFunc(cur, args);
+            }
         }
-    }
 
-    pthread_mutex_unlock(&lock);
+        pthread_mutex_unlock(&shard->lock);
+    }
 }
 
-void
- MemoryHook(void (*memHook) (MemoryAction, MemoryInfo *, void *), void *args)
-{
-    pthread_mutex_lock(&lock);
-    hook = memHook;
-    hookArgs = args;
-    pthread_mutex_unlock(&lock);
-}
+#endif
 
 static size_t
 HexPtr(unsigned long ptr, char *out, size_t len)
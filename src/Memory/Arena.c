@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <Memory.h>
+
+#include <stdint.h>
+
+#ifndef MEMORY_ARENA_CHUNK
+#define MEMORY_ARENA_CHUNK 4096
+#endif
+
+#define ARENA_ALIGN 16
+#define ARENA_ROUND(x) (((x) + (ARENA_ALIGN - 1)) & ~((size_t) ARENA_ALIGN - 1))
+
+/*
+ * Each chunk is a single heap block with this header at the front.
+ * The header is padded out to the alignment so that the data after it
+ * is aligned as well.
+ */
+typedef struct ArenaChunk
+{
+    struct ArenaChunk *next;
+    size_t size;
+    size_t used;
+} ArenaChunk;
+
+#define ARENA_HEADER ARENA_ROUND(sizeof(ArenaChunk))
+#define ARENA_DATA(chunk) (((uint8_t *) (chunk)) + ARENA_HEADER)
+
+struct MemoryArena
+{
+    ArenaChunk *chunks;
+    size_t chunkSize;
+};
+
+/*
+ * Chunks are charged to the same tag as the arena itself, which can
+ * be changed with MemoryTagSet().
+ */
+static ArenaChunk *
+ArenaChunkCreate(MemoryArena * arena, size_t size)
+{
+    MemoryTag tag = MemoryInfoGetTag(MemoryInfoGet(arena));
+    ArenaChunk *chunk = MallocTagged(ARENA_HEADER + size, tag);
+
+    if (!chunk)
+    {
+        return NULL;
+    }
+
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+
+    return chunk;
+}
+
+MemoryArena *
+MemoryArenaCreate(size_t chunkSize)
+{
+    MemoryArena *arena;
+
+    if (chunkSize > SIZE_MAX - ARENA_HEADER - ARENA_ALIGN)
+    {
+        return NULL;
+    }
+
+    arena = Malloc(sizeof(MemoryArena));
+    if (!arena)
+    {
+        return NULL;
+    }
+
+    arena->chunks = NULL;
+    arena->chunkSize = chunkSize ? ARENA_ROUND(chunkSize) : MEMORY_ARENA_CHUNK;
+
+    return arena;
+}
+
+void *
+MemoryArenaAllocate(MemoryArena * arena, size_t size)
+{
+    ArenaChunk *chunk;
+    void *p;
+
+    if (!arena || size > SIZE_MAX - ARENA_HEADER - ARENA_ALIGN)
+    {
+        /* Rounding the size up or adding a header would overflow. */
+        return NULL;
+    }
+
+    size = size ? ARENA_ROUND(size) : ARENA_ALIGN;
+    chunk = arena->chunks;
+
+    if (!chunk || chunk->size - chunk->used < size)
+    {
+        if (size > arena->chunkSize / 2)
+        {
+            /*
+             * Large allocations get a chunk of their own, which is
+             * placed behind the current one so that the space left in
+             * the current one isn't wasted.
+             */
+            chunk = ArenaChunkCreate(arena, size);
+            if (!chunk)
+            {
+                return NULL;
+            }
+
+            chunk->used = size;
+            if (arena->chunks)
+            {
+                chunk->next = arena->chunks->next;
+                arena->chunks->next = chunk;
+            }
+            else
+            {
+                arena->chunks = chunk;
+            }
+
+            return ARENA_DATA(chunk);
+        }
+
+        chunk = ArenaChunkCreate(arena, arena->chunkSize);
+        if (!chunk)
+        {
+            return NULL;
+        }
+
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+    }
+
+    p = ARENA_DATA(chunk) + chunk->used;
+    chunk->used += size;
+
+    return p;
+}
+
+int
+MemoryArenaContains(MemoryArena * arena, void *p)
+{
+    ArenaChunk *chunk;
+
+    if (!arena || !p)
+    {
+        return 0;
+    }
+
+    for (chunk = arena->chunks; chunk; chunk = chunk->next)
+    {
+        uint8_t *start = ARENA_DATA(chunk);
+
+        if ((uint8_t *) p >= start && (uint8_t *) p < start + chunk->used)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+void
+MemoryArenaReset(MemoryArena * arena)
+{
+    ArenaChunk *chunk;
+    ArenaChunk *keep = NULL;
+
+    if (!arena)
+    {
+        return;
+    }
+
+    chunk = arena->chunks;
+    while (chunk)
+    {
+        ArenaChunk *next = chunk->next;
+
+        if (!keep && chunk->size == arena->chunkSize)
+        {
+            keep = chunk;
+            keep->next = NULL;
+            keep->used = 0;
+        }
+        else
+        {
+            Free(chunk);
+        }
+
+        chunk = next;
+    }
+
+    arena->chunks = keep;
+}
+
+void
+MemoryArenaFree(MemoryArena * arena)
+{
+    if (!arena)
+    {
+        return;
+    }
+
+    MemoryArenaReset(arena);
+    Free(arena->chunks);
+    Free(arena);
+}
@@ -0,0 +1,381 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <Memory.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "Atomic.h"
+#include "Memory/Internal.h"
+
+/*
+ * The memory budget. Blocks allocated while a budget is set are
+ * counted against it, and carry MEM_FLAG_BUDGET so that they are
+ * taken off again when they are freed, even if the budget has been
+ * lifted in the meantime.
+ *
+ * Counting every allocation on one shared counter would make all the
+ * threads fight over it, so each thread keeps a private balance and
+ * only adds it to the shared counter once it is more than
+ * MEMORY_BUDGET_BATCH bytes either way. The watermarks are checked
+ * only then, so the usage seen by them can be off by at most that
+ * much per thread. For the same reason, the shared counter can dip
+ * below zero for a moment when one thread frees what another thread
+ * allocated, so it is read as a signed quantity.
+ *
+ * When the pressure level changes, the allocating thread only wakes
+ * up the notifier thread, which runs the callbacks. The callbacks can
+ * thus take whatever locks they need, and allocate and free memory,
+ * without ever running inside of an allocation.
+ */
+
+#ifndef MEMORY_BUDGET_BATCH
+#define MEMORY_BUDGET_BATCH (64 * 1024)
+#endif
+
+typedef struct BudgetThread
+{
+    long balance;
+} BudgetThread;
+
+typedef struct BudgetCallback
+{
+    void (*func) (MemoryPressure, void *);
+    void *args;
+    struct BudgetCallback *next;
+} BudgetCallback;
+
+static size_t active;
+static size_t soft;
+static size_t hard;
+static size_t usage;
+static size_t level;
+
+static pthread_key_t threadKey;
+
+/* Protects the callback list, and is held while they run. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static BudgetCallback *callbacks;
+
+/* Used to wake up the notifier. */
+static pthread_mutex_t wakeLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static pthread_t notifier;
+static int notifierRunning;
+static int notifierStop;
+
+static size_t
+BudgetClamp(size_t now)
+{
+    return now > SIZE_MAX / 2 ? 0 : now;
+}
+
+static void
+BudgetCheck(size_t now)
+{
+    size_t s = AtomicSizeLoad(&soft);
+    size_t h = AtomicSizeLoad(&hard);
+    size_t new = MEMORY_PRESSURE_NONE;
+
+    now = BudgetClamp(now);
+    if (h && now >= h)
+    {
+        new = MEMORY_PRESSURE_HARD;
+    }
+    else if (s && now >= s)
+    {
+        new = MEMORY_PRESSURE_SOFT;
+    }
+
+    if (AtomicSizeLoad(&level) == new)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&wakeLock);
+    AtomicSizeStore(&level, new);
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&wakeLock);
+}
+
+static void
+BudgetFlush(BudgetThread * t)
+{
+    size_t now;
+
+    if (t->balance >= 0)
+    {
+        now = AtomicSizeAdd(&usage, (size_t) t->balance);
+    }
+    else
+    {
+        now = AtomicSizeSub(&usage, (size_t) -t->balance);
+    }
+
+    t->balance = 0;
+    BudgetCheck(now);
+}
+
+static void
+BudgetThreadExit(void *p)
+{
+    BudgetFlush(p);
+    free(p);
+}
+
+static BudgetThread *
+BudgetThreadGet(void)
+{
+    BudgetThread *t = pthread_getspecific(threadKey);
+
+    if (!t)
+    {
+        t = MemoryLineAllocate(sizeof(BudgetThread));
+        if (!t)
+        {
+            return NULL;
+        }
+
+        t->balance = 0;
+        pthread_setspecific(threadKey, t);
+    }
+
+    return t;
+}
+
+int
+MemoryBudgetInit(void)
+{
+    return pthread_key_create(&threadKey, BudgetThreadExit) == 0;
+}
+
+void
+MemoryBudgetDestroy(void)
+{
+    BudgetThread *t;
+
+    AtomicSizeStore(&active, 0);
+
+    if (notifierRunning)
+    {
+        pthread_mutex_lock(&wakeLock);
+        notifierStop = 1;
+        pthread_cond_signal(&wake);
+        pthread_mutex_unlock(&wakeLock);
+
+        pthread_join(notifier, NULL);
+        notifierRunning = 0;
+        notifierStop = 0;
+    }
+
+    pthread_mutex_lock(&lock);
+    while (callbacks)
+    {
+        BudgetCallback *next = callbacks->next;
+
+        free(callbacks);
+        callbacks = next;
+    }
+    pthread_mutex_unlock(&lock);
+
+    t = pthread_getspecific(threadKey);
+    free(t);
+    pthread_setspecific(threadKey, NULL);
+    pthread_key_delete(threadKey);
+
+    soft = hard = usage = 0;
+    level = MEMORY_PRESSURE_NONE;
+}
+
+int
+MemoryBudgetAllocate(size_t size)
+{
+    BudgetThread *t;
+
+    if (!AtomicSizeLoad(&active))
+    {
+        return 0;
+    }
+
+    t = BudgetThreadGet();
+    if (!t || size > MEMORY_BUDGET_BATCH)
+    {
+        BudgetCheck(AtomicSizeAdd(&usage, size));
+        return 1;
+    }
+
+    t->balance += (long) size;
+    if (t->balance > MEMORY_BUDGET_BATCH)
+    {
+        BudgetFlush(t);
+    }
+
+    return 1;
+}
+
+void
+MemoryBudgetFree(size_t size)
+{
+    BudgetThread *t = BudgetThreadGet();
+
+    if (!t || size > MEMORY_BUDGET_BATCH)
+    {
+        BudgetCheck(AtomicSizeSub(&usage, size));
+        return;
+    }
+
+    t->balance -= (long) size;
+    if (t->balance < -MEMORY_BUDGET_BATCH)
+    {
+        BudgetFlush(t);
+    }
+}
+
+static void *
+BudgetNotifier(void *args)
+{
+    MemoryPressure delivered = MEMORY_PRESSURE_NONE;
+    MemoryPressure current;
+    BudgetCallback *cb;
+
+    (void) args;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&wakeLock);
+        while (!notifierStop && AtomicSizeLoad(&level) == (size_t) delivered)
+        {
+            pthread_cond_wait(&wake, &wakeLock);
+        }
+
+        if (notifierStop)
+        {
+            pthread_mutex_unlock(&wakeLock);
+            break;
+        }
+
+        current = AtomicSizeLoad(&level);
+        pthread_mutex_unlock(&wakeLock);
+
+        pthread_mutex_lock(&lock);
+        for (cb = callbacks; cb; cb = cb->next)
+        {
+            cb->func(current, cb->args);
+        }
+        pthread_mutex_unlock(&lock);
+
+        delivered = current;
+    }
+
+    return NULL;
+}
+
+int
+MemoryBudgetSet(size_t softLimit, size_t hardLimit)
+{
+    if (softLimit && hardLimit && softLimit > hardLimit)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&lock);
+    if (!notifierRunning && (softLimit || hardLimit))
+    {
+        if (pthread_create(&notifier, NULL, BudgetNotifier, NULL) != 0)
+        {
+            pthread_mutex_unlock(&lock);
+            return 0;
+        }
+        notifierRunning = 1;
+    }
+    pthread_mutex_unlock(&lock);
+
+    AtomicSizeStore(&soft, softLimit);
+    AtomicSizeStore(&hard, hardLimit);
+    AtomicSizeStore(&active, softLimit || hardLimit);
+
+    BudgetCheck(AtomicSizeLoad(&usage));
+
+    return 1;
+}
+
+size_t
+MemoryBudgetUsage(void)
+{
+    return BudgetClamp(AtomicSizeLoad(&usage));
+}
+
+MemoryPressure
+MemoryPressureGet(void)
+{
+    return AtomicSizeLoad(&level);
+}
+
+int
+MemoryPressureRegister(void (*func) (MemoryPressure, void *), void *args)
+{
+    BudgetCallback *cb;
+
+    if (!func)
+    {
+        return 0;
+    }
+
+    cb = malloc(sizeof(BudgetCallback));
+    if (!cb)
+    {
+        return 0;
+    }
+
+    cb->func = func;
+    cb->args = args;
+
+    pthread_mutex_lock(&lock);
+    cb->next = callbacks;
+    callbacks = cb;
+    pthread_mutex_unlock(&lock);
+
+    return 1;
+}
+
+void
+MemoryPressureUnregister(void (*func) (MemoryPressure, void *), void *args)
+{
+    BudgetCallback **cur;
+
+    pthread_mutex_lock(&lock);
+    for (cur = &callbacks; *cur; cur = &(*cur)->next)
+    {
+        if ((*cur)->func == func && (*cur)->args == args)
+        {
+            BudgetCallback *cb = *cur;
+
+            *cur = cb->next;
+            free(cb);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
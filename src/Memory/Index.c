@@ -0,0 +1,215 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "Atomic.h"
+#include "Memory/Internal.h"
+
+/*
+ * The index of live blocks. Every block the Memory API hands out has
+ * a bit in here, keyed by the address of its data, and
+ * MemoryInfoGet() only looks at a block's header once its bit says
+ * that there is one. Pointers that never came from the Memory API,
+ * such as pointers into the stack or into string literals, are thus
+ * rejected without ever being dereferenced.
+ *
+ * Data pointers are always a multiple of MEM_NATURAL_ALIGN, so the
+ * address space is split into granules of that size, and each granule
+ * gets one bit. The bits live in a three level radix tree over the
+ * granule number, much like a page table. Nodes are created the first
+ * time something is allocated in the range they cover, and are only
+ * released when the runtime is destroyed, so lookups never have to
+ * take a lock: they are three dependent loads.
+ */
+
+#define INDEX_GRANULE_BITS 3
+
+typedef char IndexGranuleFits[((1 << INDEX_GRANULE_BITS) == MEM_NATURAL_ALIGN) ? 1 : -1];
+
+#if UINTPTR_MAX > 0xFFFFFFFF
+#define INDEX_ADDRESS_BITS 48
+#else
+#define INDEX_ADDRESS_BITS 32
+#endif
+
+/*
+ * A leaf covers 256 KiB of address space with a 4 KiB bitmap. The
+ * root is small enough to be static, and the middle level takes the
+ * rest of the bits; a middle node is large, but few are ever needed,
+ * and the parts of it that are never written aren't backed by memory.
+ */
+#define INDEX_LEAF_BITS 15
+#define INDEX_ROOT_BITS 12
+#define INDEX_MID_BITS \
+    (INDEX_ADDRESS_BITS - INDEX_GRANULE_BITS - INDEX_LEAF_BITS - INDEX_ROOT_BITS)
+
+#define INDEX_WORD_BITS (sizeof(size_t) * 8)
+#define INDEX_LEAF_WORDS ((1 << INDEX_LEAF_BITS) / INDEX_WORD_BITS)
+
+typedef struct IndexLeaf
+{
+    size_t bits[INDEX_LEAF_WORDS];
+} IndexLeaf;
+
+typedef struct IndexMid
+{
+    IndexLeaf *leaves[1 << INDEX_MID_BITS];
+} IndexMid;
+
+static IndexMid *root[1 << INDEX_ROOT_BITS];
+
+/*
+ * Install a new node in the given slot, unless another thread beats
+ * us to it, in which case its node is used.
+ */
+static void *
+IndexNode(void *slot, size_t size)
+{
+    void *node = AtomicPtrLoad((void **) slot);
+    void *expected = NULL;
+
+    if (node)
+    {
+        return node;
+    }
+
+    node = calloc(1, size);
+    if (!node)
+    {
+        return NULL;
+    }
+
+    if (!AtomicPtrCas((void **) slot, &expected, node))
+    {
+        free(node);
+        node = expected;
+    }
+
+    return node;
+}
+
+/*
+ * Find the word of the bitmap that holds the bit of the given pointer,
+ * creating the nodes on the way to it if asked to. This returns NULL
+ * for pointers that can't be in the index at all. It is on the path
+ * of every allocation, so it is kept to a single call.
+ */
+static size_t *
+IndexWord(void *p, int create, size_t * bit)
+{
+    uintptr_t key = (uintptr_t) p;
+    size_t l;
+    IndexMid *mid;
+    IndexLeaf *leaf;
+
+    if (key % MEM_NATURAL_ALIGN)
+    {
+        return NULL;
+    }
+
+#if UINTPTR_MAX > 0xFFFFFFFF
+    if (key >> INDEX_ADDRESS_BITS)
+    {
+        return NULL;
+    }
+#endif
+
+    key >>= INDEX_GRANULE_BITS;
+    l = key & ((1 << INDEX_LEAF_BITS) - 1);
+    key >>= INDEX_LEAF_BITS;
+
+    mid = AtomicPtrLoad(&root[key >> INDEX_MID_BITS]);
+    leaf = mid ? AtomicPtrLoad(&mid->leaves[key & ((1 << INDEX_MID_BITS) - 1)]) : NULL;
+
+    if (!leaf && create)
+    {
+        mid = IndexNode(&root[key >> INDEX_MID_BITS], sizeof(IndexMid));
+        leaf = mid ? IndexNode(&mid->leaves[key & ((1 << INDEX_MID_BITS) - 1)],
+                               sizeof(IndexLeaf)) : NULL;
+    }
+
+    if (!leaf)
+    {
+        return NULL;
+    }
+
+    *bit = (size_t) 1 << (l % INDEX_WORD_BITS);
+    return &leaf->bits[l / INDEX_WORD_BITS];
+}
+
+int
+MemoryIndexAdd(void *p)
+{
+    size_t bit;
+    size_t *word = IndexWord(p, 1, &bit);
+
+    if (!word)
+    {
+        return 0;
+    }
+
+    AtomicSizeOr(word, bit);
+    return 1;
+}
+
+int
+MemoryIndexTake(void *p)
+{
+    size_t bit;
+    size_t *word = IndexWord(p, 0, &bit);
+
+    return word && (AtomicSizeFetchAnd(word, ~bit) & bit);
+}
+
+int
+MemoryIndexHas(void *p)
+{
+    size_t bit;
+    size_t *word = IndexWord(p, 0, &bit);
+
+    return word && (AtomicSizeLoad(word) & bit);
+}
+
+void
+MemoryIndexDestroy(void)
+{
+    size_t r, m;
+
+    for (r = 0; r < (1 << INDEX_ROOT_BITS); r++)
+    {
+        IndexMid *mid = AtomicPtrExchange(&root[r], NULL);
+
+        if (!mid)
+        {
+            continue;
+        }
+
+        for (m = 0; m < (1 << INDEX_MID_BITS); m++)
+        {
+            free(mid->leaves[m]);
+        }
+        free(mid);
+    }
+}
@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef CYTOPLASM_MEMORY_INTERNAL_H
+#define CYTOPLASM_MEMORY_INTERNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/*
+ * How much the Memory API keeps track of. This is selected with the
+ * --memory-tracking option to configure, and defaults to full
+ * tracking.
+ *
+ * Off: blocks only carry their size and a magic number, and are kept
+ * in the index of live blocks, so that MemoryInfoGet() still works and
+ * bad pointers are still caught.
+ * Nothing else is recorded, and the hook is only executed for bad
+ * pointers.
+ *
+ * Counters: like off, but the total number of bytes allocated is
+ * kept in an atomic counter, so MemoryAllocated() works.
+ *
+ * Full: every block is recorded along with the file and line that
+ * allocated it, boundaries are checked, and hooks are executed.
+ */
+#define MEMORY_TRACKING_OFF 0
+#define MEMORY_TRACKING_COUNTERS 1
+#define MEMORY_TRACKING_FULL 2
+
+#ifndef MEMORY_TRACKING
+#define MEMORY_TRACKING MEMORY_TRACKING_FULL
+#endif
+
+#include <Memory.h>
+
+/*
+ * Execute the current memory hook, if there is one. This is shared by
+ * all tracking levels.
+ */
+extern void MemoryHookRun(MemoryAction, MemoryInfo *);
+
+/*
+ * Release the hooks that were replaced while the runtime was up. This
+ * is called when the runtime is destroyed.
+ */
+extern void MemoryHookDestroy(void);
+
+/*
+ * The sampling heap profiler, which is shared by all tracking levels.
+ * Blocks that were sampled carry MEM_FLAG_SAMPLED in their header, so
+ * that freeing a block that wasn't sampled never has to ask the
+ * profiler about it.
+ */
+#define MEM_FLAG_SAMPLED 0x01
+
+extern int MemoryProfileInit(void);
+extern void MemoryProfileDestroy(void);
+
+/*
+ * Count an allocation of the given size against the calling thread,
+ * and return whether or not it should be sampled. This is cheap
+ * enough to call on every allocation.
+ */
+extern int MemoryProfileSample(size_t);
+
+/*
+ * Record a sampled block. This returns 0 if the block couldn't be
+ * recorded, in which case it must not be flagged as sampled.
+ */
+extern int MemoryProfileAllocate(void *, size_t, const char *, int);
+extern void MemoryProfileFree(void *, size_t);
+
+/*
+ * The memory budget, which is shared by all tracking levels. Blocks
+ * that were counted against it carry MEM_FLAG_BUDGET.
+ */
+#define MEM_FLAG_BUDGET 0x02
+
+extern int MemoryBudgetInit(void);
+extern void MemoryBudgetDestroy(void);
+
+/*
+ * Count an allocation of the given size against the budget, and
+ * return whether or not it was counted. This only loads a flag when
+ * no budget is set.
+ */
+extern int MemoryBudgetAllocate(size_t);
+extern void MemoryBudgetFree(size_t);
+
+/*
+ * Blocks allocated with an alignment larger than the backend
+ * guarantees are placed somewhere inside a bigger raw block. They
+ * carry MEM_FLAG_ALIGNED, and the raw block they came from is
+ * recorded directly in front of their header, where the padding
+ * leaves room for it.
+ */
+#define MEM_FLAG_ALIGNED 0x04
+
+typedef struct MemoryAlignedPrefix
+{
+    void *base;
+    size_t align;
+} MemoryAlignedPrefix;
+
+/* The backend aligns every block to at least this many bytes. */
+#define MEM_NATURAL_ALIGN sizeof(uint64_t)
+
+#define MEM_ALIGNED_PREFIX(info) (((MemoryAlignedPrefix *) (info)) - 1)
+#define MEM_ALIGNED_EXTRA(align) (sizeof(MemoryAlignedPrefix) + (align) - 1)
+#define MEM_ALIGN_UP(x, align) \
+    (((uintptr_t) (x) + (align) - 1) & ~((uintptr_t) (align) - 1))
+
+/*
+ * The index of live blocks, which is shared by all tracking levels.
+ * MemoryInfoGet() only trusts a pointer that is in the index, so a
+ * block must be added before it is handed out and taken out before it
+ * goes back to the backend. Adding fails if the index can't get the
+ * memory it needs, in which case the block must not be handed out.
+ * Taking a block out returns whether or not it was in the index, so
+ * that only one of two threads freeing the same pointer gets it.
+ */
+extern int MemoryIndexAdd(void *);
+extern int MemoryIndexTake(void *);
+extern int MemoryIndexHas(void *);
+extern void MemoryIndexDestroy(void);
+
+/*
+ * State that every thread updates on its own is allocated on cache
+ * lines of its own, so that threads don't slow each other down by
+ * writing to the same line. Blocks from this function come from the
+ * C library, and are released with free().
+ */
+#define MEM_CACHE_LINE 64
+
+extern void * MemoryLineAllocate(size_t);
+
+/*
+ * The tag of a block is kept in the flags above the ones defined
+ * here, and only tagged blocks are counted.
+ */
+#define MEM_TAG_SHIFT 3
+#define MEM_FLAG_TAG(f) ((unsigned int) (f) >> MEM_TAG_SHIFT)
+#define MEM_FLAG_WITH_TAG(f, t) \
+    (((f) & ((1 << MEM_TAG_SHIFT) - 1)) | ((unsigned int) (t) << MEM_TAG_SHIFT))
+
+extern void MemoryTagAllocate(unsigned int, size_t);
+extern void MemoryTagFree(unsigned int, size_t);
+extern void MemoryTagMove(unsigned int, unsigned int, size_t);
+
+/*
+ * The slab backend. When Cytoplasm is configured with --enable-slab,
+ * the Memory API gets the raw blocks it tracks from these functions
+ * instead of the C library. The sizes passed to them are the sizes of
+ * the whole block, header included, which the Memory API always
+ * knows, so the slab doesn't need a header of its own.
+ */
+extern int MemorySlabInit(void);
+extern void MemorySlabDestroy(void);
+
+extern void * MemorySlabAllocate(size_t);
+extern void * MemorySlabReallocate(void *, size_t, size_t);
+extern void MemorySlabFree(void *, size_t);
+
+/*
+ * The backend that provides the raw blocks. The size of a block is
+ * always known from its header, so it is passed along for backends
+ * that can make use of it.
+ */
+#ifdef MEMORY_SLAB
+#define MEM_BACKEND_ALLOCATE(n) MemorySlabAllocate(n)
+#define MEM_BACKEND_REALLOCATE(p, o, n) MemorySlabReallocate(p, o, n)
+#define MEM_BACKEND_FREE(p, n) MemorySlabFree(p, n)
+#else
+#define MEM_BACKEND_ALLOCATE(n) malloc(n)
+#define MEM_BACKEND_REALLOCATE(p, o, n) realloc(p, n)
+#define MEM_BACKEND_FREE(p, n) free(p)
+#endif
+
+#endif
@@ -0,0 +1,505 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <Memory.h>
+
+#include "Memory/Internal.h"
+
+#if MEMORY_TRACKING != MEMORY_TRACKING_FULL
+
+#include <stdint.h>
+#include <string.h>
+
+#include "Atomic.h"
+
+#define MEM_MAGIC 0xDEADBEEF
+#define MEM_BAD_MAGIC 0xBAADF00D
+
+/*
+ * Without full tracking, a block only carries its size, so that the
+ * size can still be queried and the counters can be kept, a magic
+ * number, so that MemoryInfoGet() can still tell whether or not a
+ * pointer came from here, and a few flags, such as whether or not the
+ * profiler sampled it. The header is 16 bytes on every platform,
+ * which keeps the data behind it aligned the same way malloc() would.
+ */
+struct MemoryInfo
+{
+    uint64_t size;
+    uint32_t flags;
+    uint32_t magic;
+};
+
+#define MEM_BLOCK_SIZE(x) (sizeof(MemoryInfo) + (x))
+
+#if MEMORY_TRACKING == MEMORY_TRACKING_COUNTERS
+static size_t allocated;
+
+#define MEM_COUNT_ADD(x) AtomicSizeAdd(&allocated, x)
+#define MEM_COUNT_SUB(x) AtomicSizeSub(&allocated, x)
+#else
+#define MEM_COUNT_ADD(x) (void) (x)
+#define MEM_COUNT_SUB(x) (void) (x)
+#endif
+
+int
+MemoryRuntimeInit(void)
+{
+    if (!MemoryProfileInit() || !MemoryBudgetInit())
+    {
+        return 0;
+    }
+
+#ifdef MEMORY_SLAB
+    return MemorySlabInit();
+#else
+    return 1;
+#endif
+}
+
+int
+MemoryRuntimeDestroy(void)
+{
+    MemoryHookDestroy();
+    MemoryIndexDestroy();
+    MemoryProfileDestroy();
+    MemoryBudgetDestroy();
+
+#ifdef MEMORY_SLAB
+    MemorySlabDestroy();
+#endif
+    return 1;
+}
+
+/*
+ * Report a pointer that the memory API doesn't know about, such as
+ * one that was already freed. The hook expects a memory info
+ * structure, so a temporary one is built on the stack.
+ */
+static void
+MemoryBadPointer(void *p)
+{
+    struct
+    {
+        MemoryInfo info;
+        void *pointer;
+    } bad;
+
+    bad.info.size = 0;
+    bad.info.flags = 0;
+    bad.info.magic = MEM_BAD_MAGIC;
+    bad.pointer = p;
+    MemoryHookRun(MEMORY_BAD_POINTER, &bad.info);
+}
+
+/*
+ * Hand a block back to the backend. Aligned blocks are somewhere in
+ * the middle of the raw block they were carved from.
+ */
+static void
+MemoryRelease(MemoryInfo * a)
+{
+    if (a->flags & MEM_FLAG_ALIGNED)
+    {
+        MemoryAlignedPrefix *prefix = MEM_ALIGNED_PREFIX(a);
+
+        MEM_BACKEND_FREE(prefix->base,
+            MEM_BLOCK_SIZE(a->size) + MEM_ALIGNED_EXTRA(prefix->align));
+        return;
+    }
+
+    MEM_BACKEND_FREE(a, MEM_BLOCK_SIZE(a->size));
+}
+
+/*
+ * Allocate a block with the given alignment, or with the natural
+ * alignment of the backend if it is 0.
+ */
+static void *
+MemoryAllocateBlock(size_t size, size_t align, MemoryTag tag,
+                    const char *file, int line)
+{
+    MemoryInfo *a;
+    void *raw;
+
+    raw = MEM_BACKEND_ALLOCATE(MEM_BLOCK_SIZE(size) +
+                               (align ? MEM_ALIGNED_EXTRA(align) : 0));
+    if (!raw)
+    {
+        return NULL;
+    }
+
+    if (align)
+    {
+        a = ((MemoryInfo *) MEM_ALIGN_UP((uint8_t *) raw +
+            sizeof(MemoryAlignedPrefix) + sizeof(MemoryInfo), align)) - 1;
+        a->flags = MEM_FLAG_WITH_TAG(MEM_FLAG_ALIGNED, tag);
+
+        MEM_ALIGNED_PREFIX(a)->base = raw;
+        MEM_ALIGNED_PREFIX(a)->align = align;
+    }
+    else
+    {
+        a = raw;
+        a->flags = MEM_FLAG_WITH_TAG(0, tag);
+    }
+
+    /* Blocks are zeroed at every tracking level, as in full mode */
+    memset(a + 1, 0, size);
+
+    a->size = size;
+    a->magic = MEM_MAGIC;
+
+    if (!MemoryIndexAdd(a + 1))
+    {
+        MEM_BACKEND_FREE(raw, MEM_BLOCK_SIZE(size) +
+                         (align ? MEM_ALIGNED_EXTRA(align) : 0));
+        return NULL;
+    }
+
+    if (tag)
+    {
+        MemoryTagAllocate(tag, size);
+    }
+
+    if (MemoryBudgetAllocate(size))
+    {
+        a->flags |= MEM_FLAG_BUDGET;
+    }
+
+    if (MemoryProfileSample(size) && MemoryProfileAllocate(a + 1, size, file, line))
+    {
+        a->flags |= MEM_FLAG_SAMPLED;
+    }
+
+    MEM_COUNT_ADD(size);
+
+    return a + 1;
+}
+
+void *
+MemoryAllocateTagged(size_t size, MemoryTag tag, const char *file, int line)
+{
+    return MemoryAllocateBlock(size, 0, tag, file, line);
+}
+
+void *
+MemoryAllocateAligned(size_t size, size_t align, const char *file, int line)
+{
+    if (!align || (align & (align - 1)))
+    {
+        return NULL;
+    }
+
+    return MemoryAllocateBlock(size, align > MEM_NATURAL_ALIGN ? align : 0,
+                               MEMORY_TAG_NONE, file, line);
+}
+
+void *
+MemoryAllocate(size_t size, const char *file, int line)
+{
+    return MemoryAllocateTagged(size, MEMORY_TAG_NONE, file, line);
+}
+
+void *
+MemoryReallocate(void *p, size_t size, const char *file, int line)
+{
+    MemoryInfo *a;
+    MemoryInfo *new;
+    size_t old;
+
+    if (!p)
+    {
+        return MemoryAllocate(size, file, line);
+    }
+
+    a = MemoryInfoGet(p);
+    if (!a)
+    {
+        MemoryBadPointer(p);
+        return NULL;
+    }
+
+    /*
+     * The backend can't keep an aligned block aligned when it moves,
+     * so it is copied into a new one instead.
+     */
+    if (a->flags & MEM_FLAG_ALIGNED)
+    {
+        void *copy = MemoryAllocateBlock(size, MEM_ALIGNED_PREFIX(a)->align,
+                                         MEM_FLAG_TAG(a->flags), file, line);
+
+        if (copy)
+        {
+            memcpy(copy, p, a->size < size ? a->size : size);
+            MemoryFree(p, file, line);
+        }
+        return copy;
+    }
+
+    old = a->size;
+
+    if (a->flags & MEM_FLAG_SAMPLED)
+    {
+        MemoryProfileFree(p, old);
+        a->flags &= ~MEM_FLAG_SAMPLED;
+    }
+
+    /*
+     * Once the backend has the block, its old address may be handed
+     * out again by another thread, so it must leave the index first.
+     * Don't leave a valid magic number behind either.
+     */
+    MemoryIndexTake(p);
+    a->magic = ~MEM_MAGIC;
+    new = MEM_BACKEND_REALLOCATE(a, MEM_BLOCK_SIZE(old), MEM_BLOCK_SIZE(size));
+    if (!new)
+    {
+        a->magic = MEM_MAGIC;
+        MemoryIndexAdd(p);
+        return NULL;
+    }
+
+    if (!MemoryIndexAdd(new + 1))
+    {
+        /*
+         * The block moved to a part of the address space that the
+         * index has no room for. This can only happen when memory is
+         * exhausted, and the contents can't be moved back, so the
+         * block is lost rather than handed out untracked.
+         */
+        if (MEM_FLAG_TAG(new->flags))
+        {
+            MemoryTagFree(MEM_FLAG_TAG(new->flags), old);
+        }
+        if (new->flags & MEM_FLAG_BUDGET)
+        {
+            MemoryBudgetFree(old);
+        }
+
+        MEM_COUNT_SUB(old);
+        MEM_BACKEND_FREE(new, MEM_BLOCK_SIZE(size));
+        return NULL;
+    }
+
+    a = new;
+    a->size = size;
+    a->magic = MEM_MAGIC;
+
+    if (MEM_FLAG_TAG(a->flags))
+    {
+        MemoryTagFree(MEM_FLAG_TAG(a->flags), old);
+        MemoryTagAllocate(MEM_FLAG_TAG(a->flags), size);
+    }
+
+    if (a->flags & MEM_FLAG_BUDGET)
+    {
+        MemoryBudgetFree(old);
+        a->flags &= ~MEM_FLAG_BUDGET;
+    }
+    if (MemoryBudgetAllocate(size))
+    {
+        a->flags |= MEM_FLAG_BUDGET;
+    }
+
+    if (MemoryProfileSample(size) && MemoryProfileAllocate(a + 1, size, file, line))
+    {
+        a->flags |= MEM_FLAG_SAMPLED;
+    }
+
+    MEM_COUNT_SUB(old);
+    MEM_COUNT_ADD(size);
+
+    return a + 1;
+}
+
+void
+MemoryFree(void *p, const char *file, int line)
+{
+    MemoryInfo *a;
+
+    (void) file;
+    (void) line;
+
+    if (!p)
+    {
+        return;
+    }
+
+    /*
+     * Taking the block out of the index is what validates the pointer,
+     * so that a block freed twice at once is only released once.
+     */
+    a = ((MemoryInfo *) p) - 1;
+    if (!MemoryIndexTake(p) || a->magic != MEM_MAGIC)
+    {
+        MemoryBadPointer(p);
+        return;
+    }
+
+    if (a->flags & MEM_FLAG_SAMPLED)
+    {
+        MemoryProfileFree(p, a->size);
+    }
+
+    if (MEM_FLAG_TAG(a->flags))
+    {
+        MemoryTagFree(MEM_FLAG_TAG(a->flags), a->size);
+    }
+
+    if (a->flags & MEM_FLAG_BUDGET)
+    {
+        MemoryBudgetFree(a->size);
+    }
+
+    a->magic = ~MEM_MAGIC;
+
+    MEM_COUNT_SUB(a->size);
+    MemoryRelease(a);
+}
+
+size_t
+MemoryAllocated(void)
+{
+#if MEMORY_TRACKING == MEMORY_TRACKING_COUNTERS
+    return AtomicSizeLoad(&allocated);
+#else
+    return 0;
+#endif
+}
+
+void
+MemoryFreeAll(void)
+{
+    /* Blocks aren't recorded anywhere, so there's nothing to do. */
+}
+
+MemoryInfo *
+MemoryInfoGet(void *p)
+{
+    MemoryInfo *a;
+
+    if (!p)
+    {
+        return NULL;
+    }
+
+    /* The header of a pointer that isn't indexed may not even exist. */
+    if (!MemoryIndexHas(p))
+    {
+        return NULL;
+    }
+
+    a = ((MemoryInfo *) p) - 1;
+    if (a->magic != MEM_MAGIC)
+    {
+        return NULL;
+    }
+
+    return a;
+}
+
+size_t
+MemoryInfoGetSize(MemoryInfo * a)
+{
+    if (!a)
+    {
+        return 0;
+    }
+
+    return a->size;
+}
+
+const char *
+MemoryInfoGetFile(MemoryInfo * a)
+{
+    if (!a)
+    {
+        return NULL;
+    }
+
+    return "(unknown)";
+}
+
+int
+MemoryInfoGetLine(MemoryInfo * a)
+{
+    if (!a)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+MemoryTag
+MemoryInfoGetTag(MemoryInfo * a)
+{
+    if (!a)
+    {
+        return MEMORY_TAG_NONE;
+    }
+
+    return MEM_FLAG_TAG(a->flags);
+}
+
+void
+MemoryTagSet(void *p, MemoryTag tag)
+{
+    MemoryInfo *a = MemoryInfoGet(p);
+
+    if (!a || (unsigned int) tag >= MEMORY_TAG_COUNT ||
+        MEM_FLAG_TAG(a->flags) == (unsigned int) tag)
+    {
+        return;
+    }
+
+    MemoryTagMove(MEM_FLAG_TAG(a->flags), tag, a->size);
+    a->flags = MEM_FLAG_WITH_TAG(a->flags, tag);
+}
+
+void *
+MemoryInfoGetPointer(MemoryInfo * a)
+{
+    if (!a)
+    {
+        return NULL;
+    }
+
+    if (a->magic == MEM_BAD_MAGIC)
+    {
+        /* Temporary info from MemoryBadPointer() */
+        return *((void **) (a + 1));
+    }
+
+    return a + 1;
+}
+
+void
+MemoryIterate(void (*iterFunc) (MemoryInfo *, void *), void *args)
+{
+    (void) iterFunc;
+    (void) args;
+}
+
+#endif
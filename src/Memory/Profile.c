@@ -0,0 +1,825 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <Memory.h>
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "Atomic.h"
+#include "Memory/Internal.h"
+
+#if defined(__GLIBC__) || defined(__APPLE__)
+#include <execinfo.h>
+#define PROFILE_BACKTRACE
+#endif
+
+/*
+ * The sampling heap profiler. Instead of recording every block, each
+ * thread counts down the bytes it allocates, and the allocation that
+ * crosses zero is sampled. The distance between samples is drawn from
+ * an exponential distribution with the configured mean, so that every
+ * byte has the same chance of being sampled, no matter the size of the
+ * block it is in. This is the same scheme tcmalloc uses, which means
+ * pprof knows how to scale the samples back up.
+ *
+ * Samples are aggregated per call site, so the profile stays the same
+ * size no matter how big the heap gets. Everything here uses the C
+ * library directly, because the profiler can't profile itself.
+ */
+
+#ifndef MEMORY_PROFILE_RATE
+#define MEMORY_PROFILE_RATE (512 * 1024)
+#endif
+
+#ifndef MEMORY_PROFILE_SITES
+#define MEMORY_PROFILE_SITES 1024
+#endif
+
+#ifndef MEMORY_PROFILE_DEPTH
+#define MEMORY_PROFILE_DEPTH 32
+#endif
+
+/* Frames belonging to the Memory API itself. */
+#define PROFILE_SKIP 2
+
+typedef struct ProfileSite
+{
+    const char *file;
+    int line;
+
+    /* The stack of the first sample taken at this site. */
+    size_t depth;
+    void *frames[MEMORY_PROFILE_DEPTH];
+
+    size_t allocs;
+    size_t allocBytes;
+    size_t live;
+    size_t liveBytes;
+} ProfileSite;
+
+/*
+ * Sampled blocks that are still live, so that frees can be charged to
+ * the right site. This is an open addressed table with linear
+ * probing; it only ever holds sampled blocks, so it stays small.
+ */
+typedef struct ProfileBlock
+{
+    void *p;
+    size_t site;
+} ProfileBlock;
+
+typedef struct ProfileThread
+{
+    size_t rate;
+    size_t countdown;
+    uint64_t seed;
+} ProfileThread;
+
+/* Protects the site table and the block table. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t rate;
+static pthread_key_t threadKey;
+
+/* Slot 0 collects the samples of sites that don't fit in the table. */
+static ProfileSite sites[MEMORY_PROFILE_SITES] = {{"(unknown)", 0, 0, {NULL}, 0, 0, 0, 0}};
+
+static ProfileBlock *blocks;
+static size_t blocksSize;
+static size_t blocksUsed;
+
+static int signalNumber;
+static int signalPipe[2] = {-1, -1};
+static pthread_t signalThread;
+static char *signalPath;
+static MemoryProfileFormat signalFormat;
+
+int
+MemoryProfileInit(void)
+{
+    return pthread_key_create(&threadKey, free) == 0;
+}
+
+static void
+ProfileSignalHandler(int sig)
+{
+    int err = errno;
+
+    (void) sig;
+    if (write(signalPipe[1], "p", 1) < 0)
+    {
+        /* Nothing can be done about it in a signal handler. */
+    }
+    errno = err;
+}
+
+static void *
+ProfileSignalThread(void *args)
+{
+    char c;
+    ssize_t n;
+    int fd;
+
+    (void) args;
+
+    while ((n = read(signalPipe[0], &c, 1)) != 0)
+    {
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+
+        if (c == 'q')
+        {
+            break;
+        }
+
+        fd = open(signalPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0)
+        {
+            MemoryProfileWrite(fd, signalFormat);
+            close(fd);
+        }
+    }
+
+    return NULL;
+}
+
+/* Stop dumping the profile on a signal, if that was set up. */
+static void
+ProfileSignalStop(void)
+{
+    if (!signalNumber)
+    {
+        return;
+    }
+
+    signal(signalNumber, SIG_DFL);
+    if (write(signalPipe[1], "q", 1) == 1)
+    {
+        pthread_join(signalThread, NULL);
+    }
+    close(signalPipe[0]);
+    close(signalPipe[1]);
+    signalPipe[0] = signalPipe[1] = -1;
+    signalNumber = 0;
+
+    free(signalPath);
+    signalPath = NULL;
+}
+
+void
+MemoryProfileDestroy(void)
+{
+    MemoryProfileStop();
+    ProfileSignalStop();
+
+    /* Threads that already exited have released their own state. */
+    free(pthread_getspecific(threadKey));
+    pthread_setspecific(threadKey, NULL);
+    pthread_key_delete(threadKey);
+
+    pthread_mutex_lock(&lock);
+    free(blocks);
+    blocks = NULL;
+    blocksSize = 0;
+    blocksUsed = 0;
+    memset(sites + 1, 0, sizeof(sites) - sizeof(*sites));
+    sites[0].depth = 0;
+    sites[0].allocs = sites[0].allocBytes = 0;
+    sites[0].live = sites[0].liveBytes = 0;
+    pthread_mutex_unlock(&lock);
+}
+
+void
+MemoryProfileStart(size_t mean)
+{
+    AtomicSizeStore(&rate, mean ? mean : MEMORY_PROFILE_RATE);
+}
+
+void
+MemoryProfileStop(void)
+{
+    AtomicSizeStore(&rate, 0);
+}
+
+/*
+ * Draw the number of bytes until the next sample from an exponential
+ * distribution with the given mean, using a xorshift generator.
+ */
+static size_t
+ProfileInterval(ProfileThread * t, size_t mean)
+{
+    double u;
+    double next;
+
+    t->seed ^= t->seed << 13;
+    t->seed ^= t->seed >> 7;
+    t->seed ^= t->seed << 17;
+
+    /* 53 random bits, so u is uniform in [0, 1). */
+    u = (double) (t->seed >> 11) / 9007199254740992.0;
+    next = -log(1.0 - u) * (double) mean;
+
+    if (next < 1.0)
+    {
+        return 1;
+    }
+    if (next > (double) (SIZE_MAX / 2))
+    {
+        return SIZE_MAX / 2;
+    }
+    return (size_t) next;
+}
+
+int
+MemoryProfileSample(size_t size)
+{
+    size_t mean = AtomicSizeLoad(&rate);
+    ProfileThread *t;
+
+    if (!mean)
+    {
+        return 0;
+    }
+
+    t = pthread_getspecific(threadKey);
+    if (!t)
+    {
+        t = MemoryLineAllocate(sizeof(ProfileThread));
+        if (!t)
+        {
+            return 0;
+        }
+
+        t->seed = ((uint64_t) (uintptr_t) t << 16) ^ (uint64_t) time(NULL);
+        t->seed |= 1;
+        t->rate = 0;
+        pthread_setspecific(threadKey, t);
+    }
+
+    if (t->rate != mean)
+    {
+        t->rate = mean;
+        t->countdown = ProfileInterval(t, mean);
+    }
+
+    if (size < t->countdown)
+    {
+        t->countdown -= size;
+        return 0;
+    }
+
+    t->countdown = ProfileInterval(t, mean);
+    return 1;
+}
+
+static size_t
+ProfileBlockHash(void *p)
+{
+    uintptr_t h = (uintptr_t) p >> 4;
+
+    h ^= h >> 16;
+    h *= 0x45d9f3b;
+    h ^= h >> 16;
+
+    return (size_t) h;
+}
+
+/* The caller must hold the lock. */
+static int
+ProfileBlockGrow(void)
+{
+    ProfileBlock *old = blocks;
+    size_t oldSize = blocksSize;
+    size_t newSize = oldSize ? oldSize * 2 : 256;
+    size_t i;
+
+    blocks = calloc(newSize, sizeof(ProfileBlock));
+    if (!blocks)
+    {
+        blocks = old;
+        return 0;
+    }
+
+    blocksSize = newSize;
+    for (i = 0; i < oldSize; i++)
+    {
+        if (old[i].p)
+        {
+            size_t j = ProfileBlockHash(old[i].p) & (newSize - 1);
+
+            while (blocks[j].p)
+            {
+                j = (j + 1) & (newSize - 1);
+            }
+            blocks[j] = old[i];
+        }
+    }
+
+    free(old);
+    return 1;
+}
+
+/*
+ * Find the site for the given file and line, adding it if it isn't
+ * there yet. The caller must hold the lock.
+ */
+static size_t
+ProfileSiteGet(const char *file, int line)
+{
+    unsigned long hash = ((unsigned long) file >> 3) * 31 + (unsigned long) line;
+    size_t index = 1 + (hash % (MEMORY_PROFILE_SITES - 1));
+    size_t probes;
+
+    for (probes = 1; probes < MEMORY_PROFILE_SITES; probes++)
+    {
+        ProfileSite *site = &sites[index];
+
+        if (!site->file)
+        {
+            site->file = file;
+            site->line = line;
+            return index;
+        }
+
+        if (site->line == line && site->file == file)
+        {
+            return index;
+        }
+
+        index = (index % (MEMORY_PROFILE_SITES - 1)) + 1;
+    }
+
+    return 0;
+}
+
+int
+MemoryProfileAllocate(void *p, size_t size, const char *file, int line)
+{
+    void *frames[MEMORY_PROFILE_DEPTH + PROFILE_SKIP];
+    int depth = 0;
+    ProfileSite *site;
+    size_t index;
+    size_t i;
+
+#ifdef PROFILE_BACKTRACE
+    depth = backtrace(frames, MEMORY_PROFILE_DEPTH + PROFILE_SKIP);
+#endif
+
+    pthread_mutex_lock(&lock);
+
+    if (blocksUsed >= blocksSize / 2 && !ProfileBlockGrow())
+    {
+        pthread_mutex_unlock(&lock);
+        return 0;
+    }
+
+    index = ProfileSiteGet(file, line);
+    site = &sites[index];
+
+    if (!site->allocs && depth > PROFILE_SKIP)
+    {
+        site->depth = depth - PROFILE_SKIP;
+        memcpy(site->frames, frames + PROFILE_SKIP, site->depth * sizeof(void *));
+    }
+
+    site->allocs++;
+    site->allocBytes += size;
+    site->live++;
+    site->liveBytes += size;
+
+    i = ProfileBlockHash(p) & (blocksSize - 1);
+    while (blocks[i].p)
+    {
+        i = (i + 1) & (blocksSize - 1);
+    }
+    blocks[i].p = p;
+    blocks[i].site = index;
+    blocksUsed++;
+
+    pthread_mutex_unlock(&lock);
+    return 1;
+}
+
+void
+MemoryProfileFree(void *p, size_t size)
+{
+    size_t i;
+    size_t j;
+
+    pthread_mutex_lock(&lock);
+
+    if (!blocksSize)
+    {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+
+    i = ProfileBlockHash(p) & (blocksSize - 1);
+    while (blocks[i].p && blocks[i].p != p)
+    {
+        i = (i + 1) & (blocksSize - 1);
+    }
+
+    if (!blocks[i].p)
+    {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+
+    sites[blocks[i].site].live--;
+    sites[blocks[i].site].liveBytes -= size;
+
+    /*
+     * Shift the rest of the cluster back, so that lookups never stop
+     * at the hole.
+     */
+    blocks[i].p = NULL;
+    blocksUsed--;
+    for (j = (i + 1) & (blocksSize - 1); blocks[j].p; j = (j + 1) & (blocksSize - 1))
+    {
+        size_t home = ProfileBlockHash(blocks[j].p) & (blocksSize - 1);
+
+        if (((j - home) & (blocksSize - 1)) >= ((j - i) & (blocksSize - 1)))
+        {
+            blocks[i] = blocks[j];
+            blocks[j].p = NULL;
+            i = j;
+        }
+    }
+
+    pthread_mutex_unlock(&lock);
+}
+
+typedef struct ProfileOut
+{
+    int fd;
+    int ok;
+    size_t len;
+    char buf[4096];
+} ProfileOut;
+
+static void
+ProfileFlush(ProfileOut * out)
+{
+    size_t off = 0;
+
+    while (out->ok && off < out->len)
+    {
+        ssize_t n = write(out->fd, out->buf + off, out->len - off);
+
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            out->ok = 0;
+            break;
+        }
+        off += n;
+    }
+
+    out->len = 0;
+}
+
+static void
+ProfilePrintf(ProfileOut * out, const char *fmt,...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(out->buf + out->len, sizeof(out->buf) - out->len, fmt, ap);
+    va_end(ap);
+
+    if (n < 0)
+    {
+        return;
+    }
+
+    if ((size_t) n >= sizeof(out->buf) - out->len)
+    {
+        ProfileFlush(out);
+
+        /* Anything longer than the buffer is truncated. */
+        va_start(ap, fmt);
+        n = vsnprintf(out->buf, sizeof(out->buf), fmt, ap);
+        va_end(ap);
+
+        if (n < 0)
+        {
+            return;
+        }
+        if ((size_t) n >= sizeof(out->buf))
+        {
+            n = sizeof(out->buf) - 1;
+        }
+    }
+
+    out->len += n;
+}
+
+/*
+ * Scale a site's samples up to an estimate of the real number of
+ * bytes. A block of size s is sampled with probability
+ * 1 - exp(-s / rate), so each sample stands for the inverse of that.
+ */
+static size_t
+ProfileUnsample(size_t count, size_t bytes, size_t mean)
+{
+    double avg;
+    double scale;
+
+    if (!count || !bytes)
+    {
+        return 0;
+    }
+
+    avg = (double) bytes / (double) count;
+    scale = 1.0 / (1.0 - exp(-avg / (double) mean));
+
+    return (size_t) ((double) bytes * scale + 0.5);
+}
+
+/*
+ * Print one frame of a stack in collapsed form. backtrace_symbols()
+ * gives "object(function+offset) [address]"; only the function name
+ * is kept, and the address is used when the symbol isn't known.
+ */
+static void
+ProfileFrame(ProfileOut * out, void *frame, const char *symbol)
+{
+    const char *start = symbol ? strchr(symbol, '(') : NULL;
+    size_t len = 0;
+
+    if (start)
+    {
+        start++;
+        len = strcspn(start, "+)");
+    }
+
+    if (len)
+    {
+        ProfilePrintf(out, "%.*s;", (int) len, start);
+    }
+    else
+    {
+        ProfilePrintf(out, "%p;", frame);
+    }
+}
+
+static void
+ProfileCollapsed(ProfileOut * out, ProfileSite * snapshot, size_t n, size_t mean)
+{
+    size_t i;
+    size_t j;
+
+    for (i = 0; i < n; i++)
+    {
+        ProfileSite *site = &snapshot[i];
+        char **symbols = NULL;
+
+        if (!site->live)
+        {
+            continue;
+        }
+
+#ifdef PROFILE_BACKTRACE
+        if (site->depth)
+        {
+            symbols = backtrace_symbols(site->frames, site->depth);
+        }
+#endif
+
+        /* Outermost frame first. */
+        for (j = site->depth; j > 0; j--)
+        {
+            ProfileFrame(out, site->frames[j - 1], symbols ? symbols[j - 1] : NULL);
+        }
+        free(symbols);
+
+        ProfilePrintf(out, "%s:%d %zu\n", site->file, site->line,
+                      ProfileUnsample(site->live, site->liveBytes, mean));
+    }
+}
+
+/*
+ * The legacy heap profile format understood by pprof. The counts are
+ * the raw samples; pprof scales them itself from the sampling rate in
+ * the header. The address space layout is appended so that pprof can
+ * symbolize the stacks against the binary.
+ */
+static void
+ProfilePprof(ProfileOut * out, ProfileSite * snapshot, size_t n, size_t mean)
+{
+    size_t live = 0, liveBytes = 0, allocs = 0, allocBytes = 0;
+    char buf[1024];
+    ssize_t len;
+    size_t i;
+    size_t j;
+    int fd;
+
+    for (i = 0; i < n; i++)
+    {
+        live += snapshot[i].live;
+        liveBytes += snapshot[i].liveBytes;
+        allocs += snapshot[i].allocs;
+        allocBytes += snapshot[i].allocBytes;
+    }
+
+    ProfilePrintf(out, "heap profile: %6zu: %8zu [%6zu: %8zu] @ heap_v2/%zu\n",
+                  live, liveBytes, allocs, allocBytes, mean);
+
+    for (i = 0; i < n; i++)
+    {
+        ProfileSite *site = &snapshot[i];
+
+        if (!site->depth)
+        {
+            /* pprof can't place a sample without a stack. */
+            continue;
+        }
+
+        ProfilePrintf(out, "%6zu: %8zu [%6zu: %8zu] @",
+                      site->live, site->liveBytes,
+                      site->allocs, site->allocBytes);
+        for (j = 0; j < site->depth; j++)
+        {
+            ProfilePrintf(out, " %p", site->frames[j]);
+        }
+        ProfilePrintf(out, "\n");
+    }
+
+    fd = open("/proc/self/maps", O_RDONLY);
+    if (fd < 0)
+    {
+        return;
+    }
+
+    ProfilePrintf(out, "\nMAPPED_LIBRARIES:\n");
+    ProfileFlush(out);
+    while ((len = read(fd, buf, sizeof(buf))) > 0)
+    {
+        memcpy(out->buf, buf, len);
+        out->len = len;
+        ProfileFlush(out);
+    }
+    close(fd);
+}
+
+int
+MemoryProfileWrite(int fd, MemoryProfileFormat format)
+{
+    ProfileSite *snapshot;
+    ProfileOut *out;
+    size_t mean = AtomicSizeLoad(&rate);
+    size_t n = 0;
+    size_t i;
+    int ret;
+
+    if (fd < 0)
+    {
+        return 0;
+    }
+
+    /*
+     * Copy the sites that have samples, so that the lock isn't held
+     * while the profile is formatted and written out.
+     */
+    snapshot = malloc(sizeof(sites));
+    out = malloc(sizeof(ProfileOut));
+    if (!snapshot || !out)
+    {
+        free(snapshot);
+        free(out);
+        return 0;
+    }
+
+    pthread_mutex_lock(&lock);
+    for (i = 0; i < MEMORY_PROFILE_SITES; i++)
+    {
+        if (sites[i].allocs)
+        {
+            snapshot[n++] = sites[i];
+        }
+    }
+    pthread_mutex_unlock(&lock);
+
+    if (!mean)
+    {
+        /* Stopped; the samples were taken at the default rate or the
+         * last one set, which is not known anymore. */
+        mean = MEMORY_PROFILE_RATE;
+    }
+
+    out->fd = fd;
+    out->ok = 1;
+    out->len = 0;
+
+    switch (format)
+    {
+        case MEMORY_PROFILE_COLLAPSED:
+            ProfileCollapsed(out, snapshot, n, mean);
+            break;
+        case MEMORY_PROFILE_PPROF:
+        default:
+            ProfilePprof(out, snapshot, n, mean);
+            break;
+    }
+
+    ProfileFlush(out);
+    ret = out->ok;
+
+    free(snapshot);
+    free(out);
+
+    return ret;
+}
+
+int
+MemoryProfileSignal(int sig, const char *path, MemoryProfileFormat format)
+{
+    struct sigaction sa;
+
+    if (signalNumber || !path)
+    {
+        return 0;
+    }
+
+    signalPath = malloc(strlen(path) + 1);
+    if (!signalPath)
+    {
+        return 0;
+    }
+    strcpy(signalPath, path);
+    signalFormat = format;
+
+    if (pipe(signalPipe) != 0)
+    {
+        goto error;
+    }
+
+    if (pthread_create(&signalThread, NULL, ProfileSignalThread, NULL) != 0)
+    {
+        close(signalPipe[0]);
+        close(signalPipe[1]);
+        goto error;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = ProfileSignalHandler;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+
+    signalNumber = sig;
+    if (sigaction(sig, &sa, NULL) != 0)
+    {
+        ProfileSignalStop();
+        return 0;
+    }
+
+    return 1;
+
+error:
+    signalPipe[0] = signalPipe[1] = -1;
+    free(signalPath);
+    signalPath = NULL;
+    return 0;
+}
@@ -0,0 +1,420 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "Memory/Internal.h"
+
+#ifdef MEMORY_SLAB
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/*
+ * A simple size-class slab allocator. Small blocks are carved out of
+ * large chunks and recycled through free lists, instead of going to
+ * malloc() and free() every time. Most of the allocations made while
+ * parsing a request are tiny and short-lived: hash map buckets, JSON
+ * values, array structures and short strings. Recycling them avoids
+ * the general-purpose allocator entirely and keeps objects of the
+ * same size together.
+ *
+ * Each thread keeps its own cache of free blocks for each size class,
+ * so the common case takes no locks at all. When a cache runs dry, a
+ * batch of blocks is taken from the global list for that class, and
+ * when a cache grows too large, a batch is given back. Chunks are
+ * never returned to the system until the runtime is destroyed.
+ *
+ * Free blocks are linked through their first word.
+ */
+
+#ifndef SLAB_CHUNK
+#define SLAB_CHUNK (64 * 1024)
+#endif
+
+#ifndef SLAB_BATCH
+#define SLAB_BATCH 32
+#endif
+
+#define SLAB_ALIGN 16
+#define SLAB_NEXT(p) (*((void **) (p)))
+
+/*
+ * The sizes include the 32 byte Memory header and 8 byte boundary, so
+ * the smallest class fits allocations of up to 8 bytes, and the 64
+ * byte class fits a HashMapBucket, JsonValue or Array structure.
+ */
+static const size_t classSizes[] = {
+    48, 64, 80, 96, 128, 160, 192, 256, 384, 512, 768, 1024, 1536, 2048
+};
+
+#define SLAB_CLASSES (sizeof(classSizes) / sizeof(classSizes[0]))
+#define SLAB_MAX 2048
+
+typedef struct SlabClass
+{
+    pthread_mutex_t lock;
+    void *free;
+    size_t count;
+} SlabClass;
+
+typedef struct SlabCache
+{
+    void *free[SLAB_CLASSES];
+    size_t count[SLAB_CLASSES];
+
+    struct SlabCache *prev;
+    struct SlabCache *next;
+} SlabCache;
+
+static SlabClass classes[SLAB_CLASSES];
+
+/* Maps a size in SLAB_ALIGN units to the smallest class that fits. */
+static unsigned char classIndex[SLAB_MAX / SLAB_ALIGN + 1];
+
+static pthread_mutex_t chunkLock;
+static void *chunks;
+
+/*
+ * Every thread's cache is also kept in a list, so that they can all be
+ * released when the runtime is destroyed, even those of threads that
+ * are still around.
+ */
+static pthread_mutex_t cacheLock;
+static SlabCache *caches;
+static pthread_key_t cacheKey;
+
+static void
+SlabCacheFlush(SlabCache * cache)
+{
+    size_t i;
+
+    for (i = 0; i < SLAB_CLASSES; i++)
+    {
+        SlabClass *class = &classes[i];
+
+        while (cache->free[i])
+        {
+            void *p = cache->free[i];
+
+            cache->free[i] = SLAB_NEXT(p);
+
+            pthread_mutex_lock(&class->lock);
+            SLAB_NEXT(p) = class->free;
+            class->free = p;
+            class->count++;
+            pthread_mutex_unlock(&class->lock);
+        }
+
+        cache->count[i] = 0;
+    }
+}
+
+static void
+SlabCacheDestructor(void *p)
+{
+    SlabCache *cache = p;
+
+    SlabCacheFlush(cache);
+
+    pthread_mutex_lock(&cacheLock);
+    if (cache->prev)
+    {
+        cache->prev->next = cache->next;
+    }
+    else
+    {
+        caches = cache->next;
+    }
+    if (cache->next)
+    {
+        cache->next->prev = cache->prev;
+    }
+    pthread_mutex_unlock(&cacheLock);
+
+    free(cache);
+}
+
+static SlabCache *
+SlabCacheGet(void)
+{
+    SlabCache *cache = pthread_getspecific(cacheKey);
+
+    if (!cache)
+    {
+        cache = MemoryLineAllocate(sizeof(SlabCache));
+        if (!cache)
+        {
+            return NULL;
+        }
+        memset(cache, 0, sizeof(SlabCache));
+
+        pthread_mutex_lock(&cacheLock);
+        cache->next = caches;
+        if (caches)
+        {
+            caches->prev = cache;
+        }
+        caches = cache;
+        pthread_mutex_unlock(&cacheLock);
+
+        pthread_setspecific(cacheKey, cache);
+    }
+
+    return cache;
+}
+
+/*
+ * Fill an empty cache for the given class, either from the global
+ * free list or by carving up a new chunk.
+ */
+static int
+SlabCacheFill(SlabCache * cache, size_t i)
+{
+    SlabClass *class = &classes[i];
+    size_t size = classSizes[i];
+    uint8_t *chunk;
+    size_t off;
+
+    pthread_mutex_lock(&class->lock);
+    while (class->free && cache->count[i] < SLAB_BATCH)
+    {
+        void *p = class->free;
+
+        class->free = SLAB_NEXT(p);
+        class->count--;
+
+        SLAB_NEXT(p) = cache->free[i];
+        cache->free[i] = p;
+        cache->count[i]++;
+    }
+    pthread_mutex_unlock(&class->lock);
+
+    if (cache->free[i])
+    {
+        return 1;
+    }
+
+    chunk = malloc(SLAB_CHUNK);
+    if (!chunk)
+    {
+        return 0;
+    }
+
+    /* The first aligned unit of each chunk links it to the others. */
+    pthread_mutex_lock(&chunkLock);
+    SLAB_NEXT(chunk) = chunks;
+    chunks = chunk;
+    pthread_mutex_unlock(&chunkLock);
+
+    for (off = SLAB_ALIGN; off + size <= SLAB_CHUNK; off += size)
+    {
+        SLAB_NEXT(chunk + off) = cache->free[i];
+        cache->free[i] = chunk + off;
+        cache->count[i]++;
+    }
+
+    return 1;
+}
+
+int
+MemorySlabInit(void)
+{
+    size_t i;
+    size_t j = 0;
+
+    for (i = 0; i < sizeof(classIndex); i++)
+    {
+        while (classSizes[j] < i * SLAB_ALIGN)
+        {
+            j++;
+        }
+        classIndex[i] = j;
+    }
+
+    for (i = 0; i < SLAB_CLASSES; i++)
+    {
+        classes[i].free = NULL;
+        classes[i].count = 0;
+        if (pthread_mutex_init(&classes[i].lock, NULL) != 0)
+        {
+            return 0;
+        }
+    }
+
+    chunks = NULL;
+    caches = NULL;
+    return pthread_mutex_init(&chunkLock, NULL) == 0 &&
+        pthread_mutex_init(&cacheLock, NULL) == 0 &&
+        pthread_key_create(&cacheKey, SlabCacheDestructor) == 0;
+}
+
+/*
+ * No thread may allocate once this is called, but other threads may
+ * still exist, so their caches are released here too; deleting the
+ * key means that their destructors will never run.
+ */
+void
+MemorySlabDestroy(void)
+{
+    size_t i;
+
+    pthread_setspecific(cacheKey, NULL);
+    pthread_key_delete(cacheKey);
+
+    while (caches)
+    {
+        SlabCache *next = caches->next;
+
+        free(caches);
+        caches = next;
+    }
+
+    while (chunks)
+    {
+        void *next = SLAB_NEXT(chunks);
+
+        free(chunks);
+        chunks = next;
+    }
+
+    for (i = 0; i < SLAB_CLASSES; i++)
+    {
+        pthread_mutex_destroy(&classes[i].lock);
+    }
+    pthread_mutex_destroy(&chunkLock);
+    pthread_mutex_destroy(&cacheLock);
+}
+
+void *
+MemorySlabAllocate(size_t size)
+{
+    SlabCache *cache;
+    size_t i;
+    void *p;
+
+    if (size > SLAB_MAX)
+    {
+        return malloc(size);
+    }
+
+    cache = SlabCacheGet();
+    if (!cache)
+    {
+        return NULL;
+    }
+
+    i = classIndex[(size + SLAB_ALIGN - 1) / SLAB_ALIGN];
+    if (!cache->free[i] && !SlabCacheFill(cache, i))
+    {
+        return NULL;
+    }
+
+    p = cache->free[i];
+    cache->free[i] = SLAB_NEXT(p);
+    cache->count[i]--;
+
+    return p;
+}
+
+void
+MemorySlabFree(void *p, size_t size)
+{
+    SlabCache *cache;
+    size_t i;
+
+    if (size > SLAB_MAX)
+    {
+        free(p);
+        return;
+    }
+
+    i = classIndex[(size + SLAB_ALIGN - 1) / SLAB_ALIGN];
+
+    cache = SlabCacheGet();
+    if (!cache)
+    {
+        /* Can't cache it; give it straight back to the class. */
+        pthread_mutex_lock(&classes[i].lock);
+        SLAB_NEXT(p) = classes[i].free;
+        classes[i].free = p;
+        classes[i].count++;
+        pthread_mutex_unlock(&classes[i].lock);
+        return;
+    }
+
+    SLAB_NEXT(p) = cache->free[i];
+    cache->free[i] = p;
+    cache->count[i]++;
+
+    if (cache->count[i] > 2 * SLAB_BATCH)
+    {
+        SlabClass *class = &classes[i];
+
+        pthread_mutex_lock(&class->lock);
+        while (cache->count[i] > SLAB_BATCH)
+        {
+            void *q = cache->free[i];
+
+            cache->free[i] = SLAB_NEXT(q);
+            cache->count[i]--;
+
+            SLAB_NEXT(q) = class->free;
+            class->free = q;
+            class->count++;
+        }
+        pthread_mutex_unlock(&class->lock);
+    }
+}
+
+void *
+MemorySlabReallocate(void *p, size_t oldSize, size_t newSize)
+{
+    void *new;
+
+    if (oldSize > SLAB_MAX && newSize > SLAB_MAX)
+    {
+        return realloc(p, newSize);
+    }
+
+    /* Still fits in the same class; nothing to do. */
+    if (oldSize <= SLAB_MAX && newSize <= SLAB_MAX &&
+        classIndex[(oldSize + SLAB_ALIGN - 1) / SLAB_ALIGN] ==
+        classIndex[(newSize + SLAB_ALIGN - 1) / SLAB_ALIGN])
+    {
+        return p;
+    }
+
+    new = MemorySlabAllocate(newSize);
+    if (!new)
+    {
+        return NULL;
+    }
+
+    memcpy(new, p, oldSize < newSize ? oldSize : newSize);
+    MemorySlabFree(p, oldSize);
+
+    return new;
+}
+
+#endif
@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <Memory.h>
+
+#include <stdint.h>
+
+#include "Atomic.h"
+#include "Memory/Internal.h"
+
+/*
+ * Per-tag accounting. The counters are only ever touched with atomic
+ * operations, so allocating from any thread never takes a lock. Each
+ * tag's counters are padded out to a cache line, so that two busy
+ * subsystems don't slow each other down by sharing one.
+ */
+
+typedef struct TagCounters
+{
+    size_t live;
+    size_t peak;
+    size_t allocations;
+    size_t bytes;
+
+    uint8_t pad[MEM_CACHE_LINE - 4 * sizeof(size_t)];
+} TagCounters;
+
+/* The tag is kept in the upper bits of the block flags. */
+typedef char MemoryTagFits[(MEMORY_TAG_COUNT <= (0xFF >> MEM_TAG_SHIFT) + 1) ? 1 : -1];
+
+static TagCounters counters[MEMORY_TAG_COUNT];
+
+static const char *names[MEMORY_TAG_COUNT] = {
+    "none",
+    "db",
+    "json",
+    "http",
+    "stream",
+    "log"
+};
+
+static void
+TagLive(TagCounters * c, size_t size)
+{
+    size_t live = AtomicSizeAdd(&c->live, size);
+    size_t peak = AtomicSizeLoad(&c->peak);
+
+    while (live > peak && !AtomicSizeCas(&c->peak, &peak, live));
+}
+
+void
+MemoryTagAllocate(unsigned int tag, size_t size)
+{
+    TagCounters *c = &counters[tag];
+
+    AtomicSizeAdd(&c->allocations, 1);
+    AtomicSizeAdd(&c->bytes, size);
+    TagLive(c, size);
+}
+
+void
+MemoryTagFree(unsigned int tag, size_t size)
+{
+    AtomicSizeSub(&counters[tag].live, size);
+}
+
+void
+MemoryTagMove(unsigned int from, unsigned int to, size_t size)
+{
+    if (from)
+    {
+        AtomicSizeSub(&counters[from].live, size);
+    }
+    if (to)
+    {
+        TagLive(&counters[to], size);
+    }
+}
+
+int
+MemoryTagStatsGet(MemoryTag tag, MemoryTagStats * stats)
+{
+    TagCounters *c;
+
+    if ((unsigned int) tag >= MEMORY_TAG_COUNT || !stats)
+    {
+        return 0;
+    }
+
+    c = &counters[tag];
+    stats->live = AtomicSizeLoad(&c->live);
+    stats->peak = AtomicSizeLoad(&c->peak);
+    stats->allocations = AtomicSizeLoad(&c->allocations);
+    stats->bytes = AtomicSizeLoad(&c->bytes);
+
+    return 1;
+}
+
+const char *
+MemoryTagName(MemoryTag tag)
+{
+    if ((unsigned int) tag >= MEMORY_TAG_COUNT)
+    {
+        return NULL;
+    }
+
+    return names[tag];
+}
@@ -21,18 +21,33 @@
  * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
  * SOFTWARE.
  */
+/* splice() and copy_file_range() are GNU extensions. */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include <Stream.h>
 
 #include <Io.h>
 #include <Memory.h>
 #include <Util.h>
+#include <Platform.h>
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <errno.h>
 #include <string.h>
+#include <wchar.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <sys/stat.h>
 
+#ifdef PLATFORM_LINUX
+#include <sys/sendfile.h>
+#endif
+
 #ifndef STREAM_RETRIES
 #define STREAM_RETRIES 10
 #endif
@@ -41,9 +56,43 @@
 #define STREAM_DELAY 2
 #endif
 
+/* How long a copy waits for a full socket to drain, in milliseconds */
+#ifndef STREAM_TIMEOUT
+#define STREAM_TIMEOUT 30000
+#endif
+
+/*
+ * The most buffers gathered into one write, and the size from which
+ * a buffer is written from where it is rather than copied.
+ */
+#ifndef STREAM_IOV
+#define STREAM_IOV 16
+#endif
+
+#define STREAM_IOV_COPY (IO_BUFFER / 4)
+
+/* The most bytes handed to the kernel to copy at once */
+#ifndef STREAM_CHUNK
+#define STREAM_CHUNK (1 << 20)
+#endif
+
 #define STREAM_EOF (1 << 0)
 #define STREAM_ERR (1 << 1)
 #define STREAM_TTY (1 << 2)
+#define STREAM_FD (1 << 3)         /* The Io is the file descriptor itself */
+#define STREAM_VIEW (1 << 4)       /* The read buffer is the caller's bytes */
+
+/*
+ * The ways StreamCopy() can move bytes between two file descriptors,
+ * from the best to the worst.
+ */
+typedef enum StreamCopyMethod
+{
+    STREAM_COPY_RANGE,             /* copy_file_range(), file to file */
+    STREAM_COPY_SENDFILE,          /* sendfile(), from a file */
+    STREAM_COPY_SPLICE,            /* splice(), through a pipe if need be */
+    STREAM_COPY_READ               /* read() and write() */
+} StreamCopyMethod;
 
 struct Stream
 {
@@ -65,6 +114,117 @@ struct Stream
     int fd;
 };
 
+/*
+ * Refill the read buffer once it has been read through, allocating it
+ * if need be. This returns false at the end of the stream, and on
+ * errors, having set the flags to say which it was.
+ */
+static bool
+StreamFill(Stream * stream)
+{
+    ssize_t readRes;
+
+    if (stream->flags & (STREAM_EOF | STREAM_VIEW))
+    {
+        /* A view holds all of its bytes from the start */
+        stream->flags |= STREAM_EOF;
+        return false;
+    }
+
+    if (!stream->rBuf)
+    {
+        /* No buffer allocated yet */
+        stream->rBuf = MallocTagged(IO_BUFFER, MEMORY_TAG_STREAM);
+        if (!stream->rBuf)
+        {
+            stream->flags |= STREAM_ERR;
+            return false;
+        }
+    }
+
+    readRes = IoRead(stream->io, stream->rBuf, IO_BUFFER);
+
+    if (readRes == 0)
+    {
+        stream->flags |= STREAM_EOF;
+        return false;
+    }
+
+    if (readRes == -1)
+    {
+        stream->flags |= STREAM_ERR;
+        return false;
+    }
+
+    stream->rOff = 0;
+    stream->rLen = readRes;
+
+    return true;
+}
+
+/*
+ * Write all of the given bytes to the underlying Io, which may take
+ * more than one write.
+ */
+static bool
+StreamWriteAll(Stream * stream, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+
+    while (len)
+    {
+        ssize_t writeRes = IoWrite(stream->io, (void *) p, len);
+
+        if (writeRes <= 0)
+        {
+            stream->flags |= STREAM_ERR;
+            return false;
+        }
+
+        p += writeRes;
+        len -= writeRes;
+    }
+
+    return true;
+}
+
+/*
+ * Write all of the given buffers to the underlying Io, which may take
+ * more than one write. The buffer descriptions are used up.
+ */
+static bool
+StreamWritevAll(Stream * stream, struct iovec *vec, int n)
+{
+    int off = 0;
+
+    while (off < n)
+    {
+        ssize_t writeRes = IoWritev(stream->io, vec + off, n - off);
+        size_t done;
+
+        if (writeRes <= 0)
+        {
+            stream->flags |= STREAM_ERR;
+            return false;
+        }
+
+        done = writeRes;
+        while (off < n && done >= vec[off].iov_len)
+        {
+            done -= vec[off].iov_len;
+            off++;
+        }
+
+        if (off < n)
+        {
+            vec[off].iov_base = (uint8_t *) vec[off].iov_base + done;
+            vec[off].iov_len -= done;
+        }
+    }
+
+    return true;
+}
+
 Stream *
 StreamIo(Io * io)
 {
@@ -75,7 +235,7 @@ StreamIo(Io * io)
         return NULL;
     }
 
-    stream = Malloc(sizeof(Stream));
+    stream = MallocTagged(sizeof(Stream), MEMORY_TAG_STREAM);
     if (!stream)
     {
         return NULL;
@@ -106,6 +266,7 @@ StreamFd(int fd)
     }
 
     stream->fd = fd;
+    stream->flags |= STREAM_FD;
 
     if (isatty(stream->fd))
     {
@@ -155,6 +316,60 @@ StreamOpen(const char *path, const char *mode)
     return StreamFile(fp);
 }
 
+Stream *
+StreamMemory(char **buf, size_t * len)
+{
+    Io *io = IoMemory(buf, len);
+    Stream *stream;
+
+    if (!io)
+    {
+        return NULL;
+    }
+
+    stream = StreamIo(io);
+    if (!stream)
+    {
+        IoClose(io);
+        Free(*buf);
+        *buf = NULL;
+        return NULL;
+    }
+
+    return stream;
+}
+
+Stream *
+StreamFromBuffer(const void *buf, size_t len)
+{
+    Io *io = IoFromBuffer(buf, len);
+    Stream *stream;
+
+    if (!io)
+    {
+        return NULL;
+    }
+
+    stream = StreamIo(io);
+    if (!stream)
+    {
+        IoClose(io);
+        return NULL;
+    }
+
+    /*
+     * Rather than reading the bytes into a buffer of its own, the
+     * stream reads them where they are. The Io is left at the end, so
+     * that nothing ever reads them through it a second time.
+     */
+    IoSeek(io, 0, SEEK_END);
+    stream->rBuf = (uint8_t *) buf;
+    stream->rLen = len;
+    stream->flags |= STREAM_VIEW;
+
+    return stream;
+}
+
 Stream *
 StreamStdout(void)
 {
@@ -205,21 +420,19 @@ StreamClose(Stream * stream)
         return EOF;
     }
 
-    if (stream->rBuf)
+    if (stream->rBuf && !(stream->flags & STREAM_VIEW))
     {
         Free(stream->rBuf);
     }
 
     if (stream->wBuf)
     {
-        ssize_t writeRes = IoWrite(stream->io, stream->wBuf, stream->wLen);
-
-        Free(stream->wBuf);
-
-        if (writeRes == -1)
+        if (!StreamWriteAll(stream, stream->wBuf, stream->wLen))
         {
             ret = EOF;
         }
+
+        Free(stream->wBuf);
     }
 
     if (stream->ugBuf)
@@ -233,255 +446,1233 @@ StreamClose(Stream * stream)
     return ret;
 }
 
-int
-StreamVprintf(Stream * stream, const char *fmt, va_list ap)
-{
-    /* This might look like very similar code to IoVprintf(), but I
-     * chose not to defer to IoVprintf() because that would require us
-     * to immediately flush the buffer, since the Io API is unbuffered.
-     * StreamPuts() uses StreamPutc() under the hood, which is
-     * buffered. It therefore allows us to finish filling the buffer
-     * and then only flush it when necessary, preventing superfluous
-     * writes. */
-
-    char *buf = NULL;
-    size_t bufSize = 0;
-    FILE *fp;
-
-    int ret;
+/*
+ * The flags of a conversion in a format string.
+ */
+#define STREAM_FMT_LEFT (1 << 0)   /* - */
+#define STREAM_FMT_ZERO (1 << 1)   /* 0 */
+#define STREAM_FMT_PLUS (1 << 2)   /* + */
+#define STREAM_FMT_SPACE (1 << 3)  /* space */
+#define STREAM_FMT_ALT (1 << 4)    /* # */
 
-    if (!fmt)
-    {
-        return -1;
-    }
+/*
+ * A conversion in a format string. The length is one of the C length
+ * modifiers, with hh written as H and ll as q, or 0 if there is none.
+ */
+typedef struct StreamSpec
+{
+    int flags;
+    int width;                     /* -1 if not given */
+    int prec;                      /* -1 if not given */
+    char length;
+    char conv;
+} StreamSpec;
 
-    fp = open_memstream(&buf, &bufSize);
-    if (!fp)
-    {
-        return -1;
-    }
+/*
+ * The argument of a conversion, once it has been taken from the
+ * argument list.
+ */
+typedef union StreamArg
+{
+    intmax_t i;
+    uintmax_t u;
+    double d;
+    long double ld;
+    wint_t wc;
+    const char *s;
+    const wchar_t *ws;
+    void *p;
+} StreamArg;
+
+typedef struct StreamScratch
+{
+    char *buf;
+    size_t size;
+} StreamScratch;
 
-    ret = vfprintf(fp, fmt, ap);
-    fclose(fp);
+static pthread_key_t scratchKey;
+static pthread_once_t scratchOnce = PTHREAD_ONCE_INIT;
 
-    if (ret >= 0 && stream)
-    {
-        if (StreamPuts(stream, buf) < 0)
-        {
-            ret = -1;
-        };
-    }
+static const char digitPairs[] =
+"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+"8081828384858687888990919293949596979899";
 
-    free(buf);                     /* Allocated by stdlib, not Memory
-                                    * API */
+static void
+StreamScratchFree(void *p)
+{
+    StreamScratch *scratch = p;
 
-    return ret;
+    free(scratch->buf);
+    free(scratch);
 }
 
-int
-StreamPrintf(Stream * stream, const char *fmt,...)
+static void
+StreamScratchInit(void)
 {
-    int ret;
-    va_list ap;
-
-    va_start(ap, fmt);
-    ret = StreamVprintf(stream, fmt, ap);
-    va_end(ap);
-
-    return ret;
+    pthread_key_create(&scratchKey, StreamScratchFree);
 }
 
-int
-StreamGetc(Stream * stream)
+/*
+ * Get this thread's scratch buffer, large enough for the given number
+ * of bytes. It is only needed for conversions that don't fit in a
+ * write buffer, so it is kept for the life of the thread. It comes
+ * from the C library rather than the Memory API, so that a thread
+ * that never exits doesn't show up as a leak.
+ */
+static char *
+StreamScratchGet(size_t size)
 {
-    int c;
+    StreamScratch *scratch;
 
-    if (!stream)
-    {
-        errno = EBADF;
-        return EOF;
-    }
+    pthread_once(&scratchOnce, StreamScratchInit);
 
-    /* Empty the ungetc stack first */
-    if (stream->ugLen)
+    scratch = pthread_getspecific(scratchKey);
+    if (!scratch)
     {
-        c = stream->ugBuf[stream->ugLen - 1];
-        stream->ugLen--;
-        return c;
-    }
+        scratch = calloc(1, sizeof(StreamScratch));
+        if (!scratch)
+        {
+            return NULL;
+        }
 
-    if (stream->flags & STREAM_EOF)
-    {
-        return EOF;
+        pthread_setspecific(scratchKey, scratch);
     }
 
-    if (!stream->rBuf)
+    if (scratch->size < size)
     {
-        /* No buffer allocated yet */
-        stream->rBuf = Malloc(IO_BUFFER);
-        if (!stream->rBuf)
+        char *buf = realloc(scratch->buf, size);
+
+        if (!buf)
         {
-            stream->flags |= STREAM_ERR;
-            return EOF;
+            return NULL;
         }
 
-        stream->rOff = 0;
-        stream->rLen = 0;
+        scratch->buf = buf;
+        scratch->size = size;
     }
 
-    if (stream->rOff >= stream->rLen)
+    return scratch->buf;
+}
+
+/*
+ * Write the given bytes, copying them straight into the write buffer
+ * when they fit. Most of the pieces of a format are a few bytes long,
+ * which are cheaper to copy by hand than with memcpy(). A TTY goes
+ * through StreamWrite(), which flushes it on newlines.
+ */
+static bool
+StreamAppend(Stream * stream, const char *buf, size_t len)
+{
+    if (stream->wBuf && !(stream->flags & STREAM_TTY) &&
+        len <= IO_BUFFER - stream->wLen)
     {
-        /* We read through the entire buffer; get a new one */
-        ssize_t readRes = IoRead(stream->io, stream->rBuf, IO_BUFFER);
+        uint8_t *p = stream->wBuf + stream->wLen;
 
-        if (readRes == 0)
+        stream->wLen += len;
+        if (len > 16)
         {
-            stream->flags |= STREAM_EOF;
-            return EOF;
+            memcpy(p, buf, len);
+            return true;
         }
 
-        if (readRes == -1)
+        while (len--)
         {
-            stream->flags |= STREAM_ERR;
-            return EOF;
+            *p++ = *buf++;
         }
-
-        stream->rOff = 0;
-        stream->rLen = readRes;
+        return true;
     }
 
-    /* Read the character in the buffer and advance the offset */
-    c = stream->rBuf[stream->rOff];
-    stream->rOff++;
-
-    return c;
+    return StreamWrite(stream, buf, len) >= 0;
 }
 
-int
-StreamUngetc(Stream * stream, int c)
+/*
+ * Write the given character the given number of times.
+ */
+static bool
+StreamPad(Stream * stream, int c, int n)
 {
-    if (!stream)
+    if (n <= 0)
     {
-        errno = EBADF;
-        return EOF;
+        return true;
     }
 
-    if (!stream->ugBuf)
+    if (stream->wBuf && (size_t) n <= IO_BUFFER - stream->wLen)
     {
-        stream->ugSize = IO_BUFFER;
-        stream->ugBuf = Malloc(stream->ugSize);
-
-        if (!stream->ugBuf)
-        {
-            stream->flags |= STREAM_ERR;
-            return EOF;
-        }
+        memset(stream->wBuf + stream->wLen, c, n);
+        stream->wLen += n;
+        return true;
     }
 
-    if (stream->ugLen >= stream->ugSize)
+    while (n-- > 0)
     {
-        char *new;
-
-        stream->ugSize += IO_BUFFER;
-        new = Realloc(stream->ugBuf, stream->ugSize);
-        if (!new)
+        if (StreamPutc(stream, c) == EOF)
         {
-            stream->flags |= STREAM_ERR;
-            Free(stream->ugBuf);
-            stream->ugBuf = NULL;
-            return EOF;
+            return false;
         }
-
-        Free(stream->ugBuf);
-        stream->ugBuf = new;
     }
 
-    stream->ugBuf[stream->ugLen] = c;
-    stream->ugLen++;
-
-    return c;
+    return true;
 }
 
-int
-StreamPutc(Stream * stream, int c)
+/*
+ * Write a string of the given length, padded out to the width of the
+ * conversion.
+ */
+static int
+StreamPadded(Stream * stream, StreamSpec * spec, const char *str, size_t len)
 {
-    if (!stream)
+    int pad = (spec->width > 0 && (size_t) spec->width > len) ?
+            spec->width - (int) len : 0;
+
+    if (!(spec->flags & STREAM_FMT_LEFT) && !StreamPad(stream, ' ', pad))
     {
-        errno = EBADF;
-        return EOF;
+        return -1;
     }
 
-    if (!stream->wBuf)
+    if (!StreamAppend(stream, str, len))
     {
-        stream->wBuf = Malloc(IO_BUFFER);
-        if (!stream->wBuf)
-        {
-            stream->flags |= STREAM_ERR;
-            return EOF;
-        }
+        return -1;
     }
 
-    if (stream->wLen == IO_BUFFER)
+    if ((spec->flags & STREAM_FMT_LEFT) && !StreamPad(stream, ' ', pad))
     {
-        /* Buffer full; write it */
-        ssize_t writeRes = IoWrite(stream->io, stream->wBuf, stream->wLen);
+        return -1;
+    }
 
-        if (writeRes == -1)
-        {
-            stream->flags |= STREAM_ERR;
-            return EOF;
-        }
+    return len + pad;
+}
+
+/*
+ * Write an integer in the given base after the given sign, if any,
+ * padded out to the width of the conversion. This covers the
+ * conversions that log lines, headers and JSON use, without going
+ * through the C library.
+ */
+static int
+StreamInteger(Stream * stream, StreamSpec * spec, char sign, uintmax_t u, int base)
+{
+    const char *hex = (spec->conv == 'X') ? "0123456789ABCDEF" : "0123456789abcdef";
+    char digits[sizeof(uintmax_t) * 3 + 1];
+    char *p = digits + sizeof(digits);
+    int len;
+    int pad;
+
+    if (base == 10)
+    {
+        while (u >= 100)
+        {
+            const char *pair = digitPairs + (u % 100) * 2;
+
+            u /= 100;
+            *--p = pair[1];
+            *--p = pair[0];
+        }
+
+        if (u >= 10)
+        {
+            *--p = digitPairs[u * 2 + 1];
+            *--p = digitPairs[u * 2];
+        }
+        else
+        {
+            *--p = '0' + u;
+        }
+    }
+    else
+    {
+        int shift = (base == 16) ? 4 : 3;
+
+        do
+        {
+            *--p = hex[u & (base - 1)];
+            u >>= shift;
+        } while (u);
+    }
+
+    len = (digits + sizeof(digits) - p) + (sign != 0);
+    pad = (spec->width > len) ? spec->width - len : 0;
+
+    if (!(spec->flags & (STREAM_FMT_LEFT | STREAM_FMT_ZERO)) &&
+        !StreamPad(stream, ' ', pad))
+    {
+        return -1;
+    }
+
+    if (sign && !StreamAppend(stream, &sign, 1))
+    {
+        return -1;
+    }
+
+    if ((spec->flags & (STREAM_FMT_LEFT | STREAM_FMT_ZERO)) == STREAM_FMT_ZERO &&
+        !StreamPad(stream, '0', pad))
+    {
+        return -1;
+    }
+
+    if (!StreamAppend(stream, p, digits + sizeof(digits) - p))
+    {
+        return -1;
+    }
+
+    if ((spec->flags & STREAM_FMT_LEFT) && !StreamPad(stream, ' ', pad))
+    {
+        return -1;
+    }
+
+    return len + pad;
+}
+
+/*
+ * Format a single conversion with the C library.
+ */
+static int
+StreamSnprintf(char *buf, size_t size, const char *fmt, StreamSpec * spec, StreamArg * arg)
+{
+    switch (spec->conv)
+    {
+        case 'd':
+        case 'i':
+            return snprintf(buf, size, fmt, arg->i);
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+            return snprintf(buf, size, fmt, arg->u);
+        case 'c':
+            return snprintf(buf, size, fmt, arg->wc);
+        case 's':
+            return snprintf(buf, size, fmt, arg->ws);
+        case 'p':
+            return snprintf(buf, size, fmt, arg->p);
+        default:
+            if (spec->length == 'L')
+            {
+                return snprintf(buf, size, fmt, arg->ld);
+            }
+            return snprintf(buf, size, fmt, arg->d);
+    }
+}
+
+/*
+ * Format a conversion that StreamInteger() and StreamPadded() don't
+ * cover with the C library, straight into the write buffer if it fits
+ * there, and through this thread's scratch buffer if it is larger than
+ * a write buffer.
+ */
+static int
+StreamFormat(Stream * stream, StreamSpec * spec, StreamArg * arg)
+{
+    char fmt[48];
+    char *p = fmt;
+    char *start;
+    size_t room;
+    int n;
+
+    *p++ = '%';
+    if (spec->flags & STREAM_FMT_LEFT)
+    {
+        *p++ = '-';
+    }
+    if (spec->flags & STREAM_FMT_ZERO)
+    {
+        *p++ = '0';
+    }
+    if (spec->flags & STREAM_FMT_PLUS)
+    {
+        *p++ = '+';
+    }
+    if (spec->flags & STREAM_FMT_SPACE)
+    {
+        *p++ = ' ';
+    }
+    if (spec->flags & STREAM_FMT_ALT)
+    {
+        *p++ = '#';
+    }
+    if (spec->width >= 0)
+    {
+        p += sprintf(p, "%d", spec->width);
+    }
+    if (spec->prec >= 0)
+    {
+        p += sprintf(p, ".%d", spec->prec);
+    }
+
+    /* Integers have been widened to the largest type */
+    if (strchr("diouxX", spec->conv))
+    {
+        *p++ = 'j';
+    }
+    else if (spec->length == 'l' || spec->length == 'L')
+    {
+        *p++ = spec->length;
+    }
+    *p++ = spec->conv;
+    *p = '\0';
+
+    if (!stream->wBuf)
+    {
+        stream->wBuf = MallocTagged(IO_BUFFER, MEMORY_TAG_STREAM);
+        if (!stream->wBuf)
+        {
+            stream->flags |= STREAM_ERR;
+            return -1;
+        }
+    }
+
+    room = IO_BUFFER - stream->wLen;
+    n = StreamSnprintf((char *) stream->wBuf + stream->wLen, room, fmt, spec, arg);
+    if (n < 0)
+    {
+        return -1;
+    }
+
+    if ((size_t) n >= room)
+    {
+        if (n >= IO_BUFFER)
+        {
+            char *scratch = StreamScratchGet(n + 1);
+
+            if (!scratch)
+            {
+                stream->flags |= STREAM_ERR;
+                return -1;
+            }
+
+            StreamSnprintf(scratch, n + 1, fmt, spec, arg);
+            return (StreamWrite(stream, scratch, n) < 0) ? -1 : n;
+        }
+
+        /* It fits in an empty buffer */
+        if (StreamFlush(stream) == EOF)
+        {
+            return -1;
+        }
+        StreamSnprintf((char *) stream->wBuf, IO_BUFFER, fmt, spec, arg);
+    }
+
+    start = (char *) stream->wBuf + stream->wLen;
+    stream->wLen += n;
+
+    /* Flush on newlines on a TTY, like StreamPutc() does. */
+    if (stream->flags & STREAM_TTY && memchr(start, '\n', n) &&
+        StreamFlush(stream) == EOF)
+    {
+        return -1;
+    }
+
+    return n;
+}
+
+/*
+ * Take a signed integer of the size given by the conversion off of the
+ * argument list.
+ */
+static intmax_t
+StreamSigned(StreamSpec * spec, va_list * ap)
+{
+    switch (spec->length)
+    {
+        case 'H':
+            return (signed char) va_arg(*ap, int);
+        case 'h':
+            return (short) va_arg(*ap, int);
+        case 'l':
+            return va_arg(*ap, long);
+        case 'q':
+            return va_arg(*ap, long long);
+        case 'j':
+            return va_arg(*ap, intmax_t);
+        case 'z':
+            return va_arg(*ap, ssize_t);
+        case 't':
+            return va_arg(*ap, ptrdiff_t);
+        default:
+            return va_arg(*ap, int);
+    }
+}
+
+/*
+ * Take an unsigned integer of the size given by the conversion off of
+ * the argument list.
+ */
+static uintmax_t
+StreamUnsigned(StreamSpec * spec, va_list * ap)
+{
+    switch (spec->length)
+    {
+        case 'H':
+            return (unsigned char) va_arg(*ap, unsigned int);
+        case 'h':
+            return (unsigned short) va_arg(*ap, unsigned int);
+        case 'l':
+            return va_arg(*ap, unsigned long);
+        case 'q':
+            return va_arg(*ap, unsigned long long);
+        case 'j':
+            return va_arg(*ap, uintmax_t);
+        case 'z':
+            return va_arg(*ap, size_t);
+        case 't':
+            return (size_t) va_arg(*ap, ptrdiff_t);
+        default:
+            return va_arg(*ap, unsigned int);
+    }
+}
+
+/*
+ * Store the number of characters written so far for a %n conversion.
+ */
+static void
+StreamCount(StreamSpec * spec, void *p, int total)
+{
+    switch (spec->length)
+    {
+        case 'H':
+            *(signed char *) p = total;
+            break;
+        case 'h':
+            *(short *) p = total;
+            break;
+        case 'l':
+            *(long *) p = total;
+            break;
+        case 'q':
+            *(long long *) p = total;
+            break;
+        case 'j':
+            *(intmax_t *) p = total;
+            break;
+        case 'z':
+            *(ssize_t *) p = total;
+            break;
+        case 't':
+            *(ptrdiff_t *) p = total;
+            break;
+        default:
+            *(int *) p = total;
+            break;
+    }
+}
+
+/*
+ * Parse the conversion that the format points at, write it, and move
+ * the format past it. This returns the number of characters written,
+ * or -1 on errors.
+ */
+static int
+StreamConvert(Stream * stream, const char **fmtp, va_list * ap, int total)
+{
+    const char *fmt = *fmtp + 1;
+    StreamSpec spec;
+    StreamArg arg;
+    size_t len;
+
+    spec.flags = 0;
+    spec.width = -1;
+    spec.prec = -1;
+    spec.length = 0;
+
+    for (;; fmt++)
+    {
+        if (*fmt == '-')
+        {
+            spec.flags |= STREAM_FMT_LEFT;
+        }
+        else if (*fmt == '0')
+        {
+            spec.flags |= STREAM_FMT_ZERO;
+        }
+        else if (*fmt == '+')
+        {
+            spec.flags |= STREAM_FMT_PLUS;
+        }
+        else if (*fmt == ' ')
+        {
+            spec.flags |= STREAM_FMT_SPACE;
+        }
+        else if (*fmt == '#')
+        {
+            spec.flags |= STREAM_FMT_ALT;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    if (*fmt == '*')
+    {
+        spec.width = va_arg(*ap, int);
+        if (spec.width < 0)
+        {
+            spec.flags |= STREAM_FMT_LEFT;
+            spec.width = -spec.width;
+        }
+        fmt++;
+    }
+    else
+    {
+        while (*fmt >= '0' && *fmt <= '9')
+        {
+            spec.width = (spec.width < 0 ? 0 : spec.width * 10) + (*fmt++ - '0');
+        }
+    }
+
+    if (*fmt == '.')
+    {
+        fmt++;
+        spec.prec = 0;
+        if (*fmt == '*')
+        {
+            spec.prec = va_arg(*ap, int);
+            if (spec.prec < 0)
+            {
+                spec.prec = -1;
+            }
+            fmt++;
+        }
+        else
+        {
+            while (*fmt >= '0' && *fmt <= '9')
+            {
+                spec.prec = spec.prec * 10 + (*fmt++ - '0');
+            }
+        }
+    }
+
+    switch (*fmt)
+    {
+        case 'h':
+        case 'l':
+            spec.length = *fmt++;
+            if (*fmt == spec.length)
+            {
+                spec.length = (spec.length == 'h') ? 'H' : 'q';
+                fmt++;
+            }
+            break;
+        case 'j':
+        case 'z':
+        case 't':
+        case 'L':
+            spec.length = *fmt++;
+            break;
+    }
+
+    spec.conv = *fmt;
+    if (!spec.conv)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    *fmtp = fmt + 1;
+
+    switch (spec.conv)
+    {
+        case '%':
+            return StreamAppend(stream, "%", 1) ? 1 : -1;
+        case 'd':
+        case 'i':
+            arg.i = StreamSigned(&spec, ap);
+            if (spec.prec >= 0 || spec.flags & STREAM_FMT_ALT)
+            {
+                break;
+            }
+
+            /* The + and space flags only apply to signed conversions */
+            if (arg.i < 0)
+            {
+                return StreamInteger(stream, &spec, '-', -(uintmax_t) arg.i, 10);
+            }
+            return StreamInteger(stream, &spec,
+                                 (spec.flags & STREAM_FMT_PLUS) ? '+' :
+                                 (spec.flags & STREAM_FMT_SPACE) ? ' ' : 0,
+                                 arg.i, 10);
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+            arg.u = StreamUnsigned(&spec, ap);
+            if (spec.prec >= 0 || spec.flags & STREAM_FMT_ALT)
+            {
+                break;
+            }
+            return StreamInteger(stream, &spec, 0, arg.u,
+                                 spec.conv == 'o' ? 8 : spec.conv == 'u' ? 10 : 16);
+        case 'c':
+            if (spec.length == 'l')
+            {
+                arg.wc = va_arg(*ap, wint_t);
+                break;
+            }
+            else
+            {
+                char c = va_arg(*ap, int);
+
+                return StreamPadded(stream, &spec, &c, 1);
+            }
+        case 's':
+            if (spec.length == 'l')
+            {
+                arg.ws = va_arg(*ap, const wchar_t *);
+                break;
+            }
+
+            arg.s = va_arg(*ap, const char *);
+            if (!arg.s)
+            {
+                arg.s = "(null)";
+            }
+            len = (spec.prec >= 0) ? strnlen(arg.s, spec.prec) : strlen(arg.s);
+            return StreamPadded(stream, &spec, arg.s, len);
+        case 'p':
+            arg.p = va_arg(*ap, void *);
+            break;
+        case 'a':
+        case 'A':
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'F':
+        case 'g':
+        case 'G':
+            if (spec.length == 'L')
+            {
+                arg.ld = va_arg(*ap, long double);
+            }
+            else
+            {
+                arg.d = va_arg(*ap, double);
+            }
+            break;
+        case 'n':
+            StreamCount(&spec, va_arg(*ap, void *), total);
+            return 0;
+        default:
+            errno = EINVAL;
+            return -1;
+    }
+
+    return StreamFormat(stream, &spec, &arg);
+}
+
+int
+StreamVprintf(Stream * stream, const char *fmt, va_list ap)
+{
+    /* This might look like very similar code to IoVprintf(), but I
+     * chose not to defer to IoVprintf() because that would require us
+     * to immediately flush the buffer, since the Io API is unbuffered.
+     * Instead, the format is taken apart here and each piece of it is
+     * written into the write buffer, so nothing is allocated and the
+     * buffer is only flushed when necessary, preventing superfluous
+     * writes. */
+
+    va_list args;
+    int total = 0;
+
+    if (!fmt)
+    {
+        return -1;
+    }
+
+    if (!stream)
+    {
+        return vsnprintf(NULL, 0, fmt, ap);
+    }
+
+    if (!stream->wBuf)
+    {
+        stream->wBuf = MallocTagged(IO_BUFFER, MEMORY_TAG_STREAM);
+        if (!stream->wBuf)
+        {
+            stream->flags |= STREAM_ERR;
+            return -1;
+        }
+    }
+
+    va_copy(args, ap);
+    while (*fmt)
+    {
+        const char *run = fmt;
+        int n;
+
+        while (*fmt && *fmt != '%')
+        {
+            fmt++;
+        }
+
+        if (fmt != run)
+        {
+            if (!StreamAppend(stream, run, fmt - run))
+            {
+                total = -1;
+                break;
+            }
+
+            total += fmt - run;
+            continue;
+        }
+
+        n = StreamConvert(stream, &fmt, &args, total);
+        if (n < 0)
+        {
+            total = -1;
+            break;
+        }
+        total += n;
+    }
+    va_end(args);
+
+    return total;
+}
+
+int
+StreamPrintf(Stream * stream, const char *fmt,...)
+{
+    int ret;
+    va_list ap;
+
+    va_start(ap, fmt);
+    ret = StreamVprintf(stream, fmt, ap);
+    va_end(ap);
+
+    return ret;
+}
+
+int
+StreamGetc(Stream * stream)
+{
+    int c;
+
+    if (!stream)
+    {
+        errno = EBADF;
+        return EOF;
+    }
+
+    /* Empty the ungetc stack first */
+    if (stream->ugLen)
+    {
+        c = stream->ugBuf[stream->ugLen - 1];
+        stream->ugLen--;
+        return c;
+    }
+
+    if (stream->rOff >= stream->rLen && !StreamFill(stream))
+    {
+        /* We read through the entire buffer, and there is no more */
+        return EOF;
+    }
+
+    /* Read the character in the buffer and advance the offset */
+    c = stream->rBuf[stream->rOff];
+    stream->rOff++;
+
+    return c;
+}
+
+int
+StreamUngetc(Stream * stream, int c)
+{
+    if (!stream)
+    {
+        errno = EBADF;
+        return EOF;
+    }
+
+    if (!stream->ugBuf)
+    {
+        stream->ugSize = IO_BUFFER;
+        stream->ugBuf = MallocTagged(stream->ugSize, MEMORY_TAG_STREAM);
+
+        if (!stream->ugBuf)
+        {
+            stream->flags |= STREAM_ERR;
+            return EOF;
+        }
+    }
+
+    if (stream->ugLen >= stream->ugSize)
+    {
+        char *new;
+
+        new = Realloc(stream->ugBuf, stream->ugSize + IO_BUFFER);
+        if (!new)
+        {
+            stream->flags |= STREAM_ERR;
+            return EOF;
+        }
+
+        stream->ugSize += IO_BUFFER;
+        stream->ugBuf = new;
+    }
+
+    stream->ugBuf[stream->ugLen] = c;
+    stream->ugLen++;
+
+    return c;
+}
+
+int
+StreamPutc(Stream * stream, int c)
+{
+    if (!stream)
+    {
+        errno = EBADF;
+        return EOF;
+    }
+
+    if (!stream->wBuf)
+    {
+        stream->wBuf = MallocTagged(IO_BUFFER, MEMORY_TAG_STREAM);
+        if (!stream->wBuf)
+        {
+            stream->flags |= STREAM_ERR;
+            return EOF;
+        }
+    }
+
+    if (stream->wLen == IO_BUFFER)
+    {
+        /* Buffer full; write it */
+        if (!StreamWriteAll(stream, stream->wBuf, stream->wLen))
+        {
+            return EOF;
+        }
+
+        stream->wLen = 0;
+    }
+
+    stream->wBuf[stream->wLen] = c;
+    stream->wLen++;
+
+    if (stream->flags & STREAM_TTY && c == '\n')
+    {
+        /* Newline encountered on a TTY; write now. This fixes some
+         * strange behavior on certain TTYs where a newline is written
+         * to the screen upon flush even when no newline exists in the
+         * stream. We just flush on newlines, but only if we're
+         * directly writing to a TTY. */
+        if (!StreamWriteAll(stream, stream->wBuf, stream->wLen))
+        {
+            return EOF;
+        }
 
         stream->wLen = 0;
     }
 
-    stream->wBuf[stream->wLen] = c;
-    stream->wLen++;
-
-    if (stream->flags & STREAM_TTY && c == '\n')
+    return c;
+}
+
+int
+StreamPuts(Stream * stream, char *str)
+{
+    if (!stream)
+    {
+        errno = EBADF;
+        return -1;
+    }
+
+    return (StreamWrite(stream, str, strlen(str)) < 0) ? -1 : 0;
+}
+
+ssize_t
+StreamRead(Stream * stream, void *buf, size_t len)
+{
+    uint8_t *out = buf;
+    size_t done = 0;
+
+    if (!stream)
+    {
+        errno = EBADF;
+        return -1;
+    }
+
+    /* Empty the ungetc stack first */
+    while (done < len && stream->ugLen)
+    {
+        out[done++] = stream->ugBuf[--stream->ugLen];
+    }
+
+    while (done < len)
+    {
+        size_t avail = stream->rLen - stream->rOff;
+
+        if (avail)
+        {
+            if (avail > len - done)
+            {
+                avail = len - done;
+            }
+
+            memcpy(out + done, stream->rBuf + stream->rOff, avail);
+            stream->rOff += avail;
+            done += avail;
+        }
+        else if (len - done >= IO_BUFFER)
+        {
+            /*
+             * The buffer is empty, and there is at least a buffer's
+             * worth left to read, so read it straight into place.
+             */
+            ssize_t readRes;
+
+            if (stream->flags & STREAM_EOF)
+            {
+                break;
+            }
+
+            readRes = IoRead(stream->io, out + done, len - done);
+            if (readRes == 0)
+            {
+                stream->flags |= STREAM_EOF;
+                break;
+            }
+
+            if (readRes == -1)
+            {
+                stream->flags |= STREAM_ERR;
+                break;
+            }
+
+            done += readRes;
+        }
+        else if (!StreamFill(stream))
+        {
+            break;
+        }
+    }
+
+    return done;
+}
+
+ssize_t
+StreamWrite(Stream * stream, const void *buf, size_t len)
+{
+    const uint8_t *in = buf;
+    size_t left = len;
+
+    if (!stream)
+    {
+        errno = EBADF;
+        return -1;
+    }
+
+    if (len >= IO_BUFFER)
+    {
+        /*
+         * Buffering wouldn't save any writes, so write straight from
+         * the caller's buffer, along with what is already buffered.
+         */
+        struct iovec vec;
+
+        vec.iov_base = (void *) buf;
+        vec.iov_len = len;
+
+        return StreamWritev(stream, &vec, 1);
+    }
+
+    if (!stream->wBuf)
+    {
+        stream->wBuf = MallocTagged(IO_BUFFER, MEMORY_TAG_STREAM);
+        if (!stream->wBuf)
+        {
+            stream->flags |= STREAM_ERR;
+            return -1;
+        }
+    }
+
+    while (left)
+    {
+        size_t room = IO_BUFFER - stream->wLen;
+
+        if (room > left)
+        {
+            room = left;
+        }
+
+        memcpy(stream->wBuf + stream->wLen, in, room);
+        stream->wLen += room;
+        in += room;
+        left -= room;
+
+        if (stream->wLen == IO_BUFFER)
+        {
+            if (!StreamWriteAll(stream, stream->wBuf, stream->wLen))
+            {
+                return -1;
+            }
+            stream->wLen = 0;
+        }
+    }
+
+    /* Flush on newlines on a TTY, like StreamPutc() does. */
+    if (stream->flags & STREAM_TTY && stream->wLen &&
+        memchr(buf, '\n', len) && StreamFlush(stream) == EOF)
+    {
+        return -1;
+    }
+
+    return len;
+}
+
+/*
+ * Write the gathered buffers, the first of which may be the start of
+ * the write buffer, and keep the rest of the write buffer.
+ */
+static bool
+StreamGather(Stream * stream, struct iovec *vec, int n, size_t *mark)
+{
+    if (!StreamWritevAll(stream, vec, n))
+    {
+        return false;
+    }
+
+    memmove(stream->wBuf, stream->wBuf + *mark, stream->wLen - *mark);
+    stream->wLen -= *mark;
+    *mark = 0;
+
+    return true;
+}
+
+ssize_t
+StreamWritev(Stream * stream, const struct iovec * iov, int iovcnt)
+{
+    struct iovec vec[STREAM_IOV];
+    size_t mark = 0;               /* Buffered bytes already in vec */
+    size_t total = 0;
+    bool newline = false;
+    int n = 0;
+    int i;
+
+    if (!stream)
+    {
+        errno = EBADF;
+        return -1;
+    }
+
+    if (!iov || iovcnt < 0)
     {
-        /* Newline encountered on a TTY; write now. This fixes some
-         * strange behavior on certain TTYs where a newline is written
-         * to the screen upon flush even when no newline exists in the
-         * stream. We just flush on newlines, but only if we're
-         * directly writing to a TTY. */
-        ssize_t writeRes = IoWrite(stream->io, stream->wBuf, stream->wLen);
+        errno = EINVAL;
+        return -1;
+    }
 
-        if (writeRes == -1)
+    if (!stream->wBuf)
+    {
+        stream->wBuf = MallocTagged(IO_BUFFER, MEMORY_TAG_STREAM);
+        if (!stream->wBuf)
         {
             stream->flags |= STREAM_ERR;
-            return EOF;
+            return -1;
         }
+    }
 
-        stream->wLen = 0;
+    for (i = 0; i < iovcnt; i++)
+    {
+        const uint8_t *base = iov[i].iov_base;
+        size_t len = iov[i].iov_len;
+
+        total += len;
+        if (stream->flags & STREAM_TTY && memchr(base, '\n', len))
+        {
+            newline = true;
+        }
+
+        /* Small buffers are copied, as long as they fit. */
+        if (len < STREAM_IOV_COPY && len <= IO_BUFFER - stream->wLen)
+        {
+            memcpy(stream->wBuf + stream->wLen, base, len);
+            stream->wLen += len;
+            continue;
+        }
+
+        /*
+         * Anything else is written from where it is, after whatever
+         * was buffered before it.
+         */
+        if (n + 2 > STREAM_IOV)
+        {
+            if (!StreamGather(stream, vec, n, &mark))
+            {
+                return -1;
+            }
+            n = 0;
+        }
+
+        if (stream->wLen > mark)
+        {
+            vec[n].iov_base = stream->wBuf + mark;
+            vec[n].iov_len = stream->wLen - mark;
+            mark = stream->wLen;
+            n++;
+        }
+
+        vec[n].iov_base = (void *) base;
+        vec[n].iov_len = len;
+        n++;
     }
 
-    return c;
+    if (n && !StreamGather(stream, vec, n, &mark))
+    {
+        return -1;
+    }
+
+    /* Flush on newlines on a TTY, like StreamPutc() does. */
+    if (newline && StreamFlush(stream) == EOF)
+    {
+        return -1;
+    }
+
+    return total;
 }
 
-int
-StreamPuts(Stream * stream, char *str)
+size_t
+StreamPeek(Stream * stream, const char **buf)
 {
-    int ret = 0;
+    if (!stream || !buf)
+    {
+        errno = EBADF;
+        return 0;
+    }
+
+    if (stream->ugLen)
+    {
+        /* The ungetc stack is in reverse, so only hand out its top. */
+        *buf = &stream->ugBuf[stream->ugLen - 1];
+        return 1;
+    }
+
+    if (stream->rOff >= stream->rLen && !StreamFill(stream))
+    {
+        return 0;
+    }
+
+    *buf = (const char *) stream->rBuf + stream->rOff;
+    return stream->rLen - stream->rOff;
+}
 
+void
+StreamConsume(Stream * stream, size_t len)
+{
     if (!stream)
     {
-        errno = EBADF;
-        return -1;
+        return;
     }
 
-    while (*str)
+    while (len && stream->ugLen)
     {
-        if (StreamPutc(stream, *str) == EOF)
-        {
-            ret = -1;
-            break;
-        }
+        stream->ugLen--;
+        len--;
+    }
 
-        str++;
+    if (len > stream->rLen - stream->rOff)
+    {
+        len = stream->rLen - stream->rOff;
     }
 
-    return ret;
+    stream->rOff += len;
 }
 
 char *
@@ -501,20 +1692,35 @@ StreamGets(Stream * stream, char *str, int size)
         return NULL;
     }
 
-    for (i = 0; i < size - 1; i++)
+    i = 0;
+    while (i < size - 1)
     {
-        int c = StreamGetc(stream);
+        const char *span;
+        const char *newline;
+        size_t avail = StreamPeek(stream, &span);
 
-        if (StreamEof(stream) || StreamError(stream))
+        if (!avail)
         {
             break;
         }
 
-        str[i] = c;
+        if (avail > (size_t) (size - 1 - i))
+        {
+            avail = size - 1 - i;
+        }
+
+        newline = memchr(span, '\n', avail);
+        if (newline)
+        {
+            avail = newline - span + 1;
+        }
+
+        memcpy(str + i, span, avail);
+        StreamConsume(stream, avail);
+        i += avail;
 
-        if (c == '\n')
+        if (newline)
         {
-            i++;
             break;
         }
     }
@@ -535,16 +1741,50 @@ StreamSeek(Stream * stream, off_t offset, int whence)
         return -1;
     }
 
+    if (stream->flags & STREAM_VIEW)
+    {
+        /* The whole stream is in the read buffer; seek within it */
+        switch (whence)
+        {
+            case SEEK_SET:
+                result = 0;
+                break;
+            case SEEK_CUR:
+                result = stream->rOff;
+                break;
+            case SEEK_END:
+                result = stream->rLen;
+                break;
+            default:
+                errno = EINVAL;
+                return -1;
+        }
+
+        if (offset < -result || offset > (off_t) stream->rLen - result)
+        {
+            errno = EINVAL;
+            return -1;
+        }
+
+        stream->rOff = result + offset;
+        stream->ugLen = 0;
+        stream->flags &= ~STREAM_EOF;
+
+        return stream->rOff;
+    }
+
     result = IoSeek(stream->io, offset, whence);
     if (result < 0)
     {
         return result;
     }
 
-    /* Successful seek; clear the buffers */
+    /* Successful seek; clear the buffers and the end of file */
     stream->rOff = 0;
+    stream->rLen = 0;
     stream->wLen = 0;
     stream->ugLen = 0;
+    stream->flags &= ~STREAM_EOF;
 
     return result;
 }
@@ -581,11 +1821,8 @@ StreamFlush(Stream * stream)
 
     if (stream->wLen)
     {
-        ssize_t writeRes = IoWrite(stream->io, stream->wBuf, stream->wLen);
-
-        if (writeRes == -1)
+        if (!StreamWriteAll(stream, stream->wBuf, stream->wLen))
         {
-            stream->flags |= STREAM_ERR;
             return EOF;
         }
 
@@ -595,17 +1832,330 @@ StreamFlush(Stream * stream)
     return 0;
 }
 
+static bool
+StreamPoll(int fd, short events, int timeout)
+{
+    struct pollfd pfd;
+
+    pfd.fd = fd;
+    pfd.events = events;
+    pfd.revents = 0;
+
+    return poll(&pfd, 1, timeout) > 0;
+}
+
+/*
+ * Move a chunk of the input stream to the output file descriptor
+ * through the read buffer, returning how many bytes were moved, 0 at
+ * the end of the input, or -1 on an error.
+ */
+static ssize_t
+StreamCopyRead(Stream * in, int outFd)
+{
+    const char *span;
+    size_t avail = StreamPeek(in, &span);
+    size_t done = 0;
+
+    if (!avail)
+    {
+        if (StreamEof(in))
+        {
+            return 0;
+        }
+
+        if (errno == EAGAIN)
+        {
+            StreamClearError(in);
+        }
+        return -1;
+    }
+
+    while (done < avail)
+    {
+        ssize_t writeRes = write(outFd, span + done, avail - done);
+
+        if (writeRes > 0)
+        {
+            done += writeRes;
+        }
+        else if (writeRes < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (writeRes < 0 && errno == EAGAIN &&
+                 StreamPoll(outFd, POLLOUT, STREAM_TIMEOUT))
+        {
+            continue;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    StreamConsume(in, done);
+    return done ? (ssize_t) done : -1;
+}
+
+#ifdef PLATFORM_LINUX
+/*
+ * splice() needs a pipe on one side. If neither side is one, the bytes
+ * go through a pipe of our own, which is always drained before this
+ * returns, so that nothing is left behind in it.
+ */
+static ssize_t
+StreamSplice(int inFd, int outFd, int *pipeFds)
+{
+    ssize_t res;
+    size_t left;
+
+    if (pipeFds[0] < 0)
+    {
+        return splice(inFd, NULL, outFd, NULL, STREAM_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+    }
+
+    res = splice(inFd, NULL, pipeFds[1], NULL, STREAM_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+    if (res <= 0)
+    {
+        return res;
+    }
+
+    left = res;
+    while (left)
+    {
+        ssize_t outRes = splice(pipeFds[0], NULL, outFd, NULL, left,
+                                SPLICE_F_MOVE | SPLICE_F_MORE);
+
+        if (outRes > 0)
+        {
+            left -= outRes;
+        }
+        else if (outRes < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (outRes < 0 && errno == EAGAIN &&
+                 StreamPoll(outFd, POLLOUT, STREAM_TIMEOUT))
+        {
+            continue;
+        }
+        else
+        {
+            if (!outRes)
+            {
+                errno = EPIPE;
+            }
+            return -1;
+        }
+    }
+
+    return res;
+}
+#endif
+
+/*
+ * Move a chunk from one file descriptor to the other in the best way
+ * that works, falling back on the next best way when the kernel
+ * doesn't support one for these file descriptors. This returns like
+ * read(); an EAGAIN is always the input's, since this waits for the
+ * output to drain itself.
+ */
+static ssize_t
+StreamCopyChunk(Stream * in, Stream * out, StreamCopyMethod * method, int *pipeFds)
+{
+    ssize_t res;
+
+    while (1)
+    {
+        switch (*method)
+        {
+#ifdef PLATFORM_LINUX
+            case STREAM_COPY_RANGE:
+                res = copy_file_range(in->fd, NULL, out->fd, NULL, STREAM_CHUNK, 0);
+                break;
+            case STREAM_COPY_SENDFILE:
+                res = sendfile(out->fd, in->fd, NULL, STREAM_CHUNK);
+                break;
+            case STREAM_COPY_SPLICE:
+                res = StreamSplice(in->fd, out->fd, pipeFds);
+                break;
+#endif
+            default:
+                res = StreamCopyRead(in, out->fd);
+                break;
+        }
+
+        if (res >= 0)
+        {
+            return res;
+        }
+
+        if (errno == EINTR)
+        {
+            continue;
+        }
+
+        /*
+         * copy_file_range() also refuses an output opened with
+         * O_APPEND, with EBADF.
+         */
+        if (*method != STREAM_COPY_READ &&
+            (errno == EINVAL || errno == ENOSYS || errno == EXDEV ||
+             errno == EOPNOTSUPP ||
+             (errno == EBADF && *method == STREAM_COPY_RANGE)))
+        {
+            *method = (*method == STREAM_COPY_RANGE) ?
+                    STREAM_COPY_SENDFILE : STREAM_COPY_READ;
+            continue;
+        }
+
+        if (errno == EAGAIN && !StreamPoll(out->fd, POLLOUT, 0))
+        {
+            if (!StreamPoll(out->fd, POLLOUT, STREAM_TIMEOUT))
+            {
+                errno = ETIMEDOUT;
+                return -1;
+            }
+            continue;
+        }
+
+        return -1;
+    }
+}
+
+/*
+ * Copy between two streams that are file descriptors underneath, by
+ * having the kernel move the bytes, without copying them through the
+ * buffers of the streams where it can.
+ */
+static ssize_t
+StreamCopyFd(Stream * in, Stream * out)
+{
+    StreamCopyMethod method = STREAM_COPY_READ;
+    int pipeFds[2] = {-1, -1};
+    ssize_t nBytes = 0;
+    int readFlg = 0;
+    int err = 0;
+
+    /* Whatever was already read into the buffers goes first. */
+    while (in->ugLen || in->rOff < in->rLen)
+    {
+        const char *span;
+        size_t avail = StreamPeek(in, &span);
+
+        if (StreamWrite(out, span, avail) < 0)
+        {
+            return nBytes;
+        }
+        StreamConsume(in, avail);
+        nBytes += avail;
+        readFlg = 1;
+    }
+
+    if (StreamFlush(out) == EOF || StreamEof(in))
+    {
+        return nBytes;
+    }
+
+#ifdef PLATFORM_LINUX
+    {
+        struct stat inSt;
+        struct stat outSt;
+
+        if (fstat(in->fd, &inSt) == 0 && fstat(out->fd, &outSt) == 0)
+        {
+            if (S_ISREG(inSt.st_mode) && S_ISREG(outSt.st_mode) &&
+                !(fcntl(out->fd, F_GETFL) & O_APPEND))
+            {
+                method = STREAM_COPY_RANGE;
+            }
+            else if (S_ISREG(inSt.st_mode) || S_ISBLK(inSt.st_mode))
+            {
+                method = STREAM_COPY_SENDFILE;
+            }
+            else if (S_ISFIFO(inSt.st_mode) || S_ISFIFO(outSt.st_mode))
+            {
+                method = STREAM_COPY_SPLICE;
+            }
+            else if (S_ISSOCK(outSt.st_mode) && pipe(pipeFds) == 0)
+            {
+                method = STREAM_COPY_SPLICE;
+            }
+        }
+    }
+#endif
+
+    while (1)
+    {
+        ssize_t res = StreamCopyChunk(in, out, &method, pipeFds);
+
+        if (res > 0)
+        {
+            nBytes += res;
+            readFlg = 1;
+            continue;
+        }
+
+        if (!res)
+        {
+            in->flags |= STREAM_EOF;
+            break;
+        }
+
+        /*
+         * Wait for input that isn't there yet, but only until the
+         * first byte came in; see StreamCopy() below.
+         */
+        if (errno != EAGAIN)
+        {
+            err = errno;
+            break;
+        }
+
+        if (readFlg || !StreamPoll(in->fd, POLLIN, STREAM_RETRIES * STREAM_DELAY))
+        {
+            break;
+        }
+    }
+
+    if (pipeFds[0] >= 0)
+    {
+        close(pipeFds[0]);
+        close(pipeFds[1]);
+    }
+
+    /* Don't pass off a failure as an empty input */
+    if (err && !nBytes)
+    {
+        errno = err;
+        return -1;
+    }
+
+    return nBytes;
+}
+
 ssize_t
 StreamCopy(Stream * in, Stream * out)
 {
     ssize_t nBytes = 0;
-    int c;
     int tries = 0;
     int readFlg = 0;
 
+    if (!in || !out)
+    {
+        errno = EBADF;
+        return -1;
+    }
+
+    if ((in->flags & STREAM_FD) && (out->flags & STREAM_FD))
+    {
+        return StreamCopyFd(in, out);
+    }
+
     while (1)
     {
-        c = StreamGetc(in);
+        const char *span;
+        size_t avail = StreamPeek(in, &span);
 
         if (StreamEof(in))
         {
@@ -642,8 +2192,13 @@ StreamCopy(Stream * in, Stream * out)
         readFlg = 1;
         tries = 0;
 
-        StreamPutc(out, c);
-        nBytes++;
+        /* Copy whatever is buffered in one go. */
+        if (StreamWrite(out, span, avail) < 0)
+        {
+            break;
+        }
+        StreamConsume(in, avail);
+        nBytes += avail;
     }
 
     StreamFlush(out);
@@ -204,7 +204,6 @@ UtilGetDelim(char **linePtr, size_t * n, int delim, Stream * stream)
 {
     char *curPos, *newLinePtr;
     size_t newLinePtrLen;
-    int c;
 
     if (!linePtr || !n || !stream)
     {
@@ -227,19 +226,28 @@ UtilGetDelim(char **linePtr, size_t * n, int delim, Stream * stream)
 
     while (1)
     {
-        c = StreamGetc(stream);
+        const char *span;
+        const char *end;
+        size_t avail = StreamPeek(stream, &span);
 
-        if (StreamError(stream) || (c == EOF && curPos == *linePtr))
+        if (StreamError(stream) || (!avail && curPos == *linePtr))
         {
             return -1;
         }
 
-        if (c == EOF)
+        if (!avail)
         {
             break;
         }
 
-        if ((*linePtr + *n - curPos) < 2)
+        /* Take everything up to and including the delimiter at once. */
+        end = memchr(span, delim, avail);
+        if (end)
+        {
+            avail = end - span + 1;
+        }
+
+        while ((size_t) (*linePtr + *n - curPos) < avail + 1)
         {
             if (SSIZE_MAX / 2 < *n)
             {
@@ -264,9 +272,11 @@ UtilGetDelim(char **linePtr, size_t * n, int delim, Stream * stream)
             *n = newLinePtrLen;
         }
 
-        *curPos++ = (char) c;
+        memcpy(curPos, span, avail);
+        curPos += avail;
+        StreamConsume(stream, avail);
 
-        if (c == delim)
+        if (end)
         {
             break;
         }
@@ -0,0 +1,372 @@
+/*
+ * Copyright (C) 2022-2025 Jordan Bancino <@jordan:synapse.telodendria.org>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation files
+ * (the "Software"), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include <Vector.h>
+
+#include <Memory.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef VECTOR_BLOCK
+#define VECTOR_BLOCK 16
+#endif
+
+struct Vector
+{
+    char *entries;                 /* The elements, back to back */
+    size_t elementSize;
+    size_t allocated;              /* Elements allocated on the heap */
+    size_t size;                   /* Elements actually filled */
+};
+
+#define VECTOR_AT(vector, i) ((vector)->entries + (i) * (vector)->elementSize)
+
+Vector *
+VectorCreate(size_t elementSize)
+{
+    Vector *vector;
+
+    if (!elementSize || elementSize > SIZE_MAX / VECTOR_BLOCK)
+    {
+        return NULL;
+    }
+
+    vector = Malloc(sizeof(Vector));
+    if (!vector)
+    {
+        return NULL;
+    }
+
+    vector->elementSize = elementSize;
+    vector->size = 0;
+    vector->allocated = VECTOR_BLOCK;
+    vector->entries = Malloc(elementSize * VECTOR_BLOCK);
+
+    if (!vector->entries)
+    {
+        Free(vector);
+        return NULL;
+    }
+
+    return vector;
+}
+
+void
+VectorFree(Vector * vector)
+{
+    if (vector)
+    {
+        Free(vector->entries);
+        Free(vector);
+    }
+}
+
+size_t
+VectorSize(Vector * vector)
+{
+    return vector ? vector->size : 0;
+}
+
+void *
+VectorGet(Vector * vector, size_t index)
+{
+    if (!vector || index >= vector->size)
+    {
+        return NULL;
+    }
+
+    return VECTOR_AT(vector, index);
+}
+
+void *
+VectorData(Vector * vector)
+{
+    if (!vector || !vector->size)
+    {
+        return NULL;
+    }
+
+    return vector->entries;
+}
+
+/*
+ * A vector can only be given a memory tag after VectorCreate()
+ * allocated its entries, so bring them in line with it before the
+ * first element goes in, the same way arrays do.
+ */
+static void
+VectorTag(Vector * vector)
+{
+    if (!vector->size)
+    {
+        MemoryTagSet(vector->entries, MemoryInfoGetTag(MemoryInfoGet(vector)));
+    }
+}
+
+/* Make room for at least the given number of elements, doubling. */
+static bool
+VectorGrow(Vector * vector, size_t need)
+{
+    size_t max = SIZE_MAX / vector->elementSize;
+    size_t newSize = vector->allocated ? vector->allocated : VECTOR_BLOCK;
+    char *tmp;
+
+    if (need <= vector->allocated)
+    {
+        return true;
+    }
+
+    if (need > max)
+    {
+        return false;
+    }
+
+    while (newSize < need)
+    {
+        newSize = (newSize > max / 2) ? need : newSize * 2;
+    }
+
+    tmp = Realloc(vector->entries, vector->elementSize * newSize);
+    if (!tmp)
+    {
+        return false;
+    }
+
+    vector->entries = tmp;
+    vector->allocated = newSize;
+    return true;
+}
+
+/*
+ * Find out whether the given pointer points into the elements of the
+ * vector, such as one returned by VectorGet(), and if so, where. Such
+ * a pointer no longer points at the same element once the vector has
+ * grown or shifted its elements, so it has to be worked out again from
+ * its offset.
+ */
+static bool
+VectorOffset(Vector * vector, const void *p, size_t * offset)
+{
+    uintptr_t start = (uintptr_t) vector->entries;
+    uintptr_t at = (uintptr_t) p;
+
+    if (!vector->entries || at < start ||
+        at >= start + vector->size * vector->elementSize)
+    {
+        return false;
+    }
+
+    *offset = at - start;
+    return true;
+}
+
+bool
+VectorInsert(Vector * vector, size_t index, const void *element)
+{
+    size_t offset;
+    bool inside;
+
+    if (!vector || !element || index > vector->size)
+    {
+        return false;
+    }
+
+    inside = VectorOffset(vector, element, &offset);
+
+    VectorTag(vector);
+    if (!VectorGrow(vector, vector->size + 1))
+    {
+        return false;
+    }
+
+    memmove(VECTOR_AT(vector, index + 1), VECTOR_AT(vector, index),
+            (vector->size - index) * vector->elementSize);
+
+    if (inside)
+    {
+        /* The element may have moved, both with the storage and up */
+        if (offset >= index * vector->elementSize)
+        {
+            offset += vector->elementSize;
+        }
+        element = vector->entries + offset;
+    }
+
+    memcpy(VECTOR_AT(vector, index), element, vector->elementSize);
+    vector->size++;
+
+    return true;
+}
+
+bool
+VectorAdd(Vector * vector, const void *element)
+{
+    return vector && VectorInsert(vector, vector->size, element);
+}
+
+bool
+VectorAddAll(Vector * vector, const void *elements, size_t n)
+{
+    size_t offset;
+    bool inside;
+
+    if (!vector || (n && !elements))
+    {
+        return false;
+    }
+
+    inside = VectorOffset(vector, elements, &offset);
+
+    VectorTag(vector);
+    if (n > SIZE_MAX - vector->size || !VectorGrow(vector, vector->size + n))
+    {
+        return false;
+    }
+
+    if (inside)
+    {
+        elements = vector->entries + offset;
+    }
+
+    memcpy(VECTOR_AT(vector, vector->size), elements, n * vector->elementSize);
+    vector->size += n;
+
+    return true;
+}
+
+bool
+VectorSet(Vector * vector, size_t index, const void *element)
+{
+    if (!vector || !element || index >= vector->size)
+    {
+        return false;
+    }
+
+    /* The element may be this very one */
+    memmove(VECTOR_AT(vector, index), element, vector->elementSize);
+    return true;
+}
+
+bool
+VectorDelete(Vector * vector, size_t index, void *out)
+{
+    if (!vector || index >= vector->size)
+    {
+        return false;
+    }
+
+    if (out)
+    {
+        memcpy(out, VECTOR_AT(vector, index), vector->elementSize);
+    }
+
+    memmove(VECTOR_AT(vector, index), VECTOR_AT(vector, index + 1),
+            (vector->size - index - 1) * vector->elementSize);
+    vector->size--;
+
+    /* Give back memory after mass deletions, like arrays do. */
+    if (vector->allocated > VECTOR_BLOCK && vector->size < vector->allocated / 4)
+    {
+        size_t newSize = vector->allocated / 2;
+        char *tmp = Realloc(vector->entries, vector->elementSize * newSize);
+
+        if (tmp)
+        {
+            vector->entries = tmp;
+            vector->allocated = newSize;
+        }
+    }
+
+    return true;
+}
+
+bool
+VectorReserve(Vector * vector, size_t size)
+{
+    if (!vector)
+    {
+        return false;
+    }
+
+    VectorTag(vector);
+    return VectorGrow(vector, size);
+}
+
+bool
+VectorTrim(Vector * vector)
+{
+    size_t newSize;
+    char *tmp;
+
+    if (!vector)
+    {
+        return false;
+    }
+
+    /* Keep the entries allocated, even if there aren't any. */
+    newSize = vector->size ? vector->size : 1;
+
+    tmp = Realloc(vector->entries, vector->elementSize * newSize);
+    if (!tmp)
+    {
+        return false;
+    }
+
+    vector->entries = tmp;
+    vector->allocated = newSize;
+
+    return true;
+}
+
+void
+VectorSort(Vector * vector, int (*compare) (const void *, const void *))
+{
+    if (!vector || !compare || vector->size < 2)
+    {
+        return;
+    }
+
+    qsort(vector->entries, vector->size, vector->elementSize, compare);
+}
+
+Vector *
+VectorDuplicate(Vector * vector)
+{
+    Vector *ret;
+
+    if (!vector)
+    {
+        return NULL;
+    }
+
+    ret = VectorCreate(vector->elementSize);
+    if (!ret || !VectorAddAll(ret, vector->entries, vector->size))
+    {
+        VectorFree(ret);
+        return NULL;
+    }
+
+    return ret;
+}